@@ -1,17 +1,26 @@
 #include "Logging.h"
 #include "WS_Lite.h"
+#include "internal/BufferPool.h"
 #include "internal/HeaderParser.h"
+#include "internal/PreparedMessage.h"
+#include "internal/RandomPool.h"
 #include "internal/Utils.h"
+#include "Extensions.h"
+#include "internal/WebSocketContext.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <atomic>
 #include <chrono>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
+#include <zlib.h>
 
 using namespace std::chrono_literals;
 inline std::ifstream::pos_type filesize(const std::string &filename)
@@ -319,6 +328,860 @@ void multithreadtest()
         std::this_thread::sleep_for(200ms);
     }
 }
+void batchingtest()
+{
+    std::cout << "Starting batching test..." << std::endl;
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    const auto messagecount = 1000;
+    std::atomic<int> received;
+    received = 0;
+
+    SL::WS_LITE::PortNumber port(3006);
+    auto listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                           ->NoTLS()
+                           ->CreateListener(port)
+                           ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               received += 1;
+                           })
+                           ->listen();
+
+    auto clientctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                         ->NoTLS()
+                         ->CreateClient()
+                         ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             for (auto i = 0; i < messagecount; i++) {
+                                 SL::WS_LITE::WSMessage msg;
+                                 std::string txtmsg = "batched msg " + std::to_string(i);
+                                 msg.Buffer = std::shared_ptr<unsigned char>(new unsigned char[txtmsg.size()], [](unsigned char *p) { delete[] p; });
+                                 msg.len = txtmsg.size();
+                                 msg.code = SL::WS_LITE::OpCode::TEXT;
+                                 msg.data = msg.Buffer.get();
+                                 memcpy(msg.data, txtmsg.data(), txtmsg.size());
+                                 socket->send(msg, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+                             }
+                         })
+                         ->connect("localhost", port);
+
+    while (received != messagecount &&
+           std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(200ms);
+    }
+    assert(received == messagecount);
+    auto stats = clientctx->get_Statistics();
+    std::cout << "Sent " << stats.FramesFlushed << " frames in " << stats.Flushes << " writes" << std::endl;
+    assert(stats.FramesFlushed >= static_cast<size_t>(messagecount));
+    assert(stats.Flushes < stats.FramesFlushed);
+    // the listener decodes every frame it has buffered before reading again
+    auto liststats = listenerctx->get_Statistics();
+    std::cout << "Received " << liststats.FramesReceived << " frames in " << liststats.Reads << " reads" << std::endl;
+    assert(liststats.FramesReceived >= static_cast<size_t>(messagecount));
+    assert(liststats.Reads < liststats.FramesReceived);
+}
+void fragmentationtest()
+{
+    std::cout << "Starting fragmentation test..." << std::endl;
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    const size_t messagesize = 1024 * 1024;
+    const size_t framesize = 1024 * 64;
+    std::atomic<bool> received(false), pingedbeforemessage(false);
+
+    SL::WS_LITE::PortNumber port(3007);
+    auto listenerctx =
+        SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+            ->NoTLS()
+            ->CreateListener(port)
+            ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                lastheard = std::chrono::high_resolution_clock::now();
+                SL::WS_LITE::WSMessage msg;
+                msg.Buffer = std::shared_ptr<unsigned char>(new unsigned char[messagesize], [](unsigned char *p) { delete[] p; });
+                msg.len = messagesize;
+                msg.code = SL::WS_LITE::OpCode::BINARY;
+                msg.data = msg.Buffer.get();
+                for (size_t i = 0; i < messagesize; i++) {
+                    msg.data[i] = static_cast<unsigned char>(i % 251);
+                }
+                socket->send(msg, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+                // queued behind the large message, but should go out between its fragments
+                SL::WS_LITE::WSMessage ping;
+                ping.Buffer = std::shared_ptr<unsigned char>(new unsigned char[4], [](unsigned char *p) { delete[] p; });
+                ping.len = 4;
+                ping.code = SL::WS_LITE::OpCode::PING;
+                ping.data = ping.Buffer.get();
+                memcpy(ping.data, "ping", 4);
+                socket->send(ping, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+            })
+            ->listen();
+    listenerctx->set_MaxFrameSize(framesize);
+    assert(listenerctx->get_MaxFrameSize() == framesize);
+
+    auto clientctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                         ->NoTLS()
+                         ->CreateClient()
+                         ->onPing([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const unsigned char *payload, size_t length) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             pingedbeforemessage = !received;
+                         })
+                         ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             assert(message.code == SL::WS_LITE::OpCode::BINARY);
+                             assert(message.len == messagesize);
+                             for (size_t i = 0; i < message.len; i++) {
+                                 assert(message.data[i] == static_cast<unsigned char>(i % 251));
+                             }
+                             received = true;
+                         })
+                         ->connect("localhost", port);
+
+    while (!received && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(200ms);
+    }
+    assert(received);
+    assert(pingedbeforemessage);
+    auto stats = listenerctx->get_Statistics();
+    assert(stats.FramesFlushed >= messagesize / framesize + 1);
+}
+void prioritytest()
+{
+    std::cout << "Starting priority test..." << std::endl;
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    const auto bulkcount = 10;
+    std::vector<std::string> received;
+    std::mutex receivedlock;
+    std::shared_ptr<SL::WS_LITE::IWebSocket> clientsocket;
+
+    SL::WS_LITE::PortNumber port(3008);
+    auto listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                           ->NoTLS()
+                           ->CreateListener(port)
+                           ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               std::lock_guard<std::mutex> lock(receivedlock);
+                               received.emplace_back(reinterpret_cast<const char *>(message.data), message.len);
+                           })
+                           ->listen();
+
+    auto sendtext = [](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const std::string &txtmsg, SL::WS_LITE::SendPriority priority) {
+        SL::WS_LITE::WSMessage msg;
+        msg.Buffer = std::shared_ptr<unsigned char>(new unsigned char[txtmsg.size()], [](unsigned char *p) { delete[] p; });
+        msg.len = txtmsg.size();
+        msg.code = SL::WS_LITE::OpCode::TEXT;
+        msg.data = msg.Buffer.get();
+        memcpy(msg.data, txtmsg.data(), txtmsg.size());
+        socket->send(msg, SL::WS_LITE::CompressionOptions::NO_COMPRESSION, priority);
+    };
+    auto clientctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                         ->NoTLS()
+                         ->CreateClient()
+                         ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             clientsocket = socket;
+                             // all of these reach the send queues together, so the high message overtakes every bulk one
+                             for (auto i = 0; i < bulkcount; i++) {
+                                 sendtext(socket, "bulk", SL::WS_LITE::SendPriority::BULK);
+                             }
+                             sendtext(socket, "high", SL::WS_LITE::SendPriority::HIGH);
+                         })
+                         ->connect("localhost", port);
+
+    auto done = [&] {
+        std::lock_guard<std::mutex> lock(receivedlock);
+        return received.size() == bulkcount + 1;
+    };
+    while (!done() && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(200ms);
+    }
+    assert(done());
+    assert(received[0] == "high");
+    assert(received[1] == "bulk");
+    assert(clientsocket->QueuedMessages(SL::WS_LITE::SendPriority::BULK) == 0);
+    assert(clientsocket->QueuedBytes(SL::WS_LITE::SendPriority::BULK) == 0);
+    clientsocket.reset(); // sockets cannot outlive their hub
+}
+void sendfiletest()
+{
+    std::cout << "Starting sendFile test..." << std::endl;
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    const size_t filesize = 1024 * 1024 * 3 + 123;
+    const size_t offset = 4096 + 7;
+    const size_t length = filesize - offset;
+    std::atomic<int> serverreceived(0), clientreceived(0);
+    std::shared_ptr<SL::WS_LITE::IWebSocket> clientsocket;
+
+    auto file = std::tmpfile();
+    assert(file);
+    for (size_t i = 0; i < filesize; i++) {
+        std::fputc(static_cast<int>(i % 251), file);
+    }
+    std::fflush(file);
+    auto fd = fileno(file);
+    // regions past the end of the file are refused up front, on the sendfile path of the server and the mapped one of the client
+    auto checkbounds = [&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket) {
+        assert(socket->sendFile(fd, offset, length + 1, SL::WS_LITE::OpCode::BINARY) == SL::WS_LITE::SendStatus::INVALID_FILE_REGION);
+        assert(socket->sendFile(fd, filesize + 1, 1, SL::WS_LITE::OpCode::BINARY) == SL::WS_LITE::SendStatus::INVALID_FILE_REGION);
+        assert(socket->sendFile(fd, offset, static_cast<size_t>(-1), SL::WS_LITE::OpCode::BINARY) == SL::WS_LITE::SendStatus::INVALID_FILE_REGION);
+        assert(socket->sendFile(fd, offset, 0, SL::WS_LITE::OpCode::BINARY) == SL::WS_LITE::SendStatus::INVALID_FILE_REGION);
+    };
+    auto checkmessage = [&](const SL::WS_LITE::WSMessage &message) {
+        assert(message.code == SL::WS_LITE::OpCode::BINARY);
+        assert(message.len == length);
+        for (size_t i = 0; i < message.len; i++) {
+            assert(message.data[i] == static_cast<unsigned char>((i + offset) % 251));
+        }
+    };
+
+    SL::WS_LITE::PortNumber port(3009);
+    auto listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                           ->NoTLS()
+                           ->CreateListener(port)
+                           ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               checkbounds(socket);
+                               assert(socket->sendFile(fd, offset, length, SL::WS_LITE::OpCode::BINARY) == SL::WS_LITE::SendStatus::QUEUED);
+                           })
+                           ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               checkmessage(message);
+                               serverreceived += 1;
+                           })
+                           ->listen();
+    // split the file frames so the file offset has to advance between fragments
+    listenerctx->set_MaxFrameSize(1024 * 1024);
+
+    auto clientctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                         ->NoTLS()
+                         ->CreateClient()
+                         ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             checkmessage(message);
+                             clientsocket = socket;
+                             clientreceived += 1;
+                             // clients have to mask their frames, so this goes through the mapped file instead
+                             checkbounds(socket);
+                             assert(socket->sendFile(fd, offset, length, SL::WS_LITE::OpCode::BINARY) == SL::WS_LITE::SendStatus::QUEUED);
+                         })
+                         ->connect("localhost", port);
+
+    while (serverreceived != 1 &&
+           std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(200ms);
+    }
+    assert(clientreceived == 1);
+    assert(serverreceived == 1);
+    // a closed socket is told apart from a bad region
+    clientsocket->close(1000, "done");
+    while (clientsocket->is_open() != SL::WS_LITE::SocketStatus::CLOSED &&
+           std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 4000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    assert(clientsocket->sendFile(fd, offset, length, SL::WS_LITE::OpCode::BINARY) == SL::WS_LITE::SendStatus::NOT_CONNECTED);
+    std::fclose(file);
+}
+void preparedmessagetest()
+{
+    std::cout << "Starting prepared message test..." << std::endl;
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    const auto clientcount = 20;
+    std::string txtmsg;
+    for (auto i = 0; i < 1000; i++) {
+        txtmsg += "prepared message " + std::to_string(i % 10);
+    }
+    SL::WS_LITE::WSMessage msg;
+    msg.Buffer = std::shared_ptr<unsigned char>(new unsigned char[txtmsg.size()], [](unsigned char *p) { delete[] p; });
+    msg.len = txtmsg.size();
+    msg.code = SL::WS_LITE::OpCode::TEXT;
+    msg.data = msg.Buffer.get();
+    memcpy(msg.data, txtmsg.data(), txtmsg.size());
+    auto prepared = SL::WS_LITE::CreatePreparedMessage(msg, SL::WS_LITE::CompressionOptions::COMPRESS);
+
+    // the compressed copy has to inflate back to the original once the flush tail left off by the sender is put back
+    assert(prepared->Compressed.Buffer && prepared->Compressed.len < msg.len);
+    std::vector<unsigned char> deflated(prepared->Compressed.data, prepared->Compressed.data + prepared->Compressed.len);
+    deflated.insert(deflated.end(), {0x00, 0x00, 0xff, 0xff});
+    std::vector<unsigned char> inflated(msg.len);
+    z_stream strm = {};
+    assert(inflateInit2(&strm, -MAX_WBITS) == Z_OK);
+    strm.next_in = deflated.data();
+    strm.avail_in = static_cast<uInt>(deflated.size());
+    strm.next_out = inflated.data();
+    strm.avail_out = static_cast<uInt>(inflated.size());
+    inflate(&strm, Z_SYNC_FLUSH);
+    assert(strm.avail_out == 0);
+    inflateEnd(&strm);
+    assert(memcmp(inflated.data(), msg.data, msg.len) == 0);
+    assert((prepared->CompressedHeader[0] & 64) && !(prepared->Header[0] & 64));
+
+    auto checkmessage = [&](const SL::WS_LITE::WSMessage &message) {
+        assert(message.code == SL::WS_LITE::OpCode::TEXT);
+        assert(std::string(reinterpret_cast<const char *>(message.data), message.len) == txtmsg);
+    };
+    std::atomic<int> received(0), echoed(0);
+    std::vector<std::shared_ptr<SL::WS_LITE::IWebSocket>> serversockets;
+    std::mutex serversocketslock;
+    SL::WS_LITE::PortNumber port(3010);
+    auto listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                           ->NoTLS()
+                           ->CreateListener(port)
+                           ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               std::lock_guard<std::mutex> lock(serversocketslock);
+                               serversockets.push_back(socket);
+                           })
+                           ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               checkmessage(message);
+                               echoed += 1;
+                           })
+                           ->listen();
+
+    std::vector<std::shared_ptr<SL::WS_LITE::IWSHub>> clients;
+    for (auto i = 0; i < clientcount; i++) {
+        clients.push_back(SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                              ->NoTLS()
+                              ->CreateClient()
+                              ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                                  lastheard = std::chrono::high_resolution_clock::now();
+                                  checkmessage(message);
+                                  received += 1;
+                                  // clients mask the shared payload into their own frame
+                                  socket->send(prepared);
+                              })
+                              ->connect("localhost", port));
+    }
+    auto connected = [&] {
+        std::lock_guard<std::mutex> lock(serversocketslock);
+        return serversockets.size() == clientcount;
+    };
+    while (!connected() && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    assert(connected());
+    for (auto &socket : serversockets) {
+        socket->send(prepared);
+    }
+    while (echoed != clientcount &&
+           std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(200ms);
+    }
+    assert(received == clientcount);
+    assert(echoed == clientcount);
+    serversockets.clear(); // sockets cannot outlive their hub
+}
+void pubsubtest()
+{
+    std::cout << "Starting pub/sub test..." << std::endl;
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    const auto clientcount = 10;
+    std::atomic<int> received(0);
+    std::vector<std::shared_ptr<SL::WS_LITE::IWebSocket>> serversockets;
+    std::mutex serversocketslock;
+    auto createmessage = [](const std::string &txtmsg) {
+        SL::WS_LITE::WSMessage msg;
+        msg.Buffer = std::shared_ptr<unsigned char>(new unsigned char[txtmsg.size()], [](unsigned char *p) { delete[] p; });
+        msg.len = txtmsg.size();
+        msg.code = SL::WS_LITE::OpCode::TEXT;
+        msg.data = msg.Buffer.get();
+        memcpy(msg.data, txtmsg.data(), txtmsg.size());
+        return SL::WS_LITE::CreatePreparedMessage(msg, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+    };
+    // waits until nothing was received for half a second
+    auto waitforquiet = [&] {
+        lastheard = std::chrono::high_resolution_clock::now();
+        while (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 500) {
+            std::this_thread::sleep_for(100ms);
+        }
+    };
+
+    SL::WS_LITE::PortNumber port(3011);
+    std::shared_ptr<SL::WS_LITE::IWSHub> listenerctx;
+    listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(2))
+                      ->NoTLS()
+                      ->CreateListener(port)
+                      ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                          lastheard = std::chrono::high_resolution_clock::now();
+                          listenerctx->subscribe(socket, "news");
+                          std::lock_guard<std::mutex> lock(serversocketslock);
+                          serversockets.push_back(socket);
+                      })
+                      ->listen();
+
+    std::vector<std::shared_ptr<SL::WS_LITE::IWSHub>> clients;
+    for (auto i = 0; i < clientcount; i++) {
+        clients.push_back(SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                              ->NoTLS()
+                              ->CreateClient()
+                              ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                                  lastheard = std::chrono::high_resolution_clock::now();
+                                  assert(std::string(reinterpret_cast<const char *>(message.data), message.len) == "news");
+                                  received += 1;
+                              })
+                              ->connect("localhost", port));
+    }
+    auto connected = [&] {
+        std::lock_guard<std::mutex> lock(serversocketslock);
+        return serversockets.size() == clientcount;
+    };
+    while (!connected() && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    assert(connected());
+    waitforquiet();
+
+    auto news = createmessage("news");
+    listenerctx->publish("news", news);
+    listenerctx->publish("sports", createmessage("sports")); // nobody subscribed
+    waitforquiet();
+    assert(received == clientcount);
+
+    // the unsubscribe is handled by the same thread before the publish that follows it
+    listenerctx->unsubscribe(serversockets.front(), "news");
+    listenerctx->publish("news", news);
+    waitforquiet();
+    assert(received == clientcount * 2 - 1);
+    assert(listenerctx->get_Statistics().PublishDelivered == static_cast<size_t>(clientcount * 2 - 1));
+
+    // with a tiny backlog allowed, subscribers that are still writing skip messages, but every one is accounted for
+    listenerctx->set_MaxPublishBacklog(1);
+    const auto publishcount = 20;
+    for (auto i = 0; i < publishcount; i++) {
+        listenerctx->publish("news", news);
+    }
+    waitforquiet();
+    auto stats = listenerctx->get_Statistics();
+    assert(stats.PublishDelivered + stats.PublishSkipped == static_cast<size_t>(clientcount * 2 - 1 + (clientcount - 1) * publishcount));
+    assert(received == static_cast<int>(stats.PublishDelivered));
+    serversockets.clear(); // sockets cannot outlive their hub
+}
+void bufferpooltest()
+{
+    std::cout << "Starting buffer pool test..." << std::endl;
+    // freed blocks are handed out again by the same thread
+    auto block = SL::WS_LITE::PoolAllocate(100);
+    SL::WS_LITE::PoolDeallocate(block, 100);
+    auto sameclass = SL::WS_LITE::PoolAllocate(128);
+    assert(block == sameclass);
+    SL::WS_LITE::PoolDeallocate(sameclass, 128);
+    const unsigned char *data = nullptr;
+    {
+        auto buffer = SL::WS_LITE::AllocateBuffer(1000);
+        data = buffer.get();
+    }
+    assert(SL::WS_LITE::AllocateBuffer(1000).get() == data);
+    // receive buffers grow through the size classes, and stay put while they fit in their block
+    auto capacity = SL::WS_LITE::PoolBlockSize(5000);
+    assert(capacity == 8192);
+    auto grown = static_cast<unsigned char *>(SL::WS_LITE::PoolReallocate(nullptr, 0, capacity));
+    memset(grown, 'r', capacity);
+    assert(SL::WS_LITE::PoolReallocate(grown, capacity, capacity) == grown);
+    auto larger = SL::WS_LITE::PoolBlockSize(capacity * 2);
+    grown = static_cast<unsigned char *>(SL::WS_LITE::PoolReallocate(grown, capacity, larger));
+    assert(grown[0] == 'r' && grown[capacity - 1] == 'r');
+    SL::WS_LITE::PoolDeallocate(grown, larger);
+    auto top = SL::WS_LITE::PoolAllocate(SL::WS_LITE::MAXPOOLBLOCKSIZE);
+    SL::WS_LITE::PoolDeallocate(top, SL::WS_LITE::MAXPOOLBLOCKSIZE);
+    assert(SL::WS_LITE::PoolAllocate(SL::WS_LITE::MAXPOOLBLOCKSIZE) == top);
+    SL::WS_LITE::PoolDeallocate(top, SL::WS_LITE::MAXPOOLBLOCKSIZE);
+    // a freed large block is trimmed but kept, and serves the next one that fits
+    const size_t largesize = SL::WS_LITE::MAXPOOLBLOCKSIZE * 4;
+    auto large = static_cast<unsigned char *>(SL::WS_LITE::PoolAllocate(largesize));
+    memset(large, 'l', largesize);
+    SL::WS_LITE::PoolDeallocate(large, largesize);
+    auto reused = static_cast<unsigned char *>(SL::WS_LITE::PoolAllocate(largesize / 2));
+    assert(reused == large);
+    memset(reused, 'm', largesize / 2);
+    SL::WS_LITE::PoolDeallocate(reused, largesize / 2);
+
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    const std::string txtmsg = "pooled message";
+    std::atomic<bool> echoed(false);
+    SL::WS_LITE::PortNumber port(3012);
+    auto listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                           ->NoTLS()
+                           ->CreateListener(port)
+                           ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               socket->send(message.data, message.len, message.code, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+                           })
+                           ->listen();
+    auto clientctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                         ->NoTLS()
+                         ->CreateClient()
+                         ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             socket->send(txtmsg, SL::WS_LITE::OpCode::TEXT, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+                         })
+                         ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             assert(message.code == SL::WS_LITE::OpCode::TEXT);
+                             assert(std::string(reinterpret_cast<const char *>(message.data), message.len) == txtmsg);
+                             echoed = true;
+                         })
+                         ->connect("localhost", port);
+    while (!echoed && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    assert(echoed);
+}
+void randompooltest()
+{
+    std::cout << "Starting random pool test..." << std::endl;
+    SL::WS_LITE::RandomPool random;
+    // consecutive mask keys and handshake nonces differ and are never all zero
+    unsigned int lastkey = 0;
+    std::string lastnonce(16, '\0');
+    for (auto i = 0; i < 2000; i++) {
+        unsigned int key = 0;
+        random.get(reinterpret_cast<unsigned char *>(&key), sizeof(key));
+        assert(key != 0 && key != lastkey);
+        lastkey = key;
+        std::string nonce(16, '\0');
+        random.get(reinterpret_cast<unsigned char *>(&nonce[0]), nonce.size());
+        assert(nonce != std::string(16, '\0') && nonce != lastnonce);
+        lastnonce = nonce;
+    }
+    // draws that straddle the 4 KB refill, or are larger than the pool, fill exactly what was asked for
+    for (size_t len : {4093, 7, 4096, 5000, 1, 8191}) {
+        std::vector<unsigned char> buffer(len + 16, 0xAB);
+        random.get(buffer.data() + 8, len);
+        for (size_t i = 0; i < 8; i++) {
+            assert(buffer[i] == 0xAB && buffer[len + 8 + i] == 0xAB);
+        }
+        // about one byte in 256 is zero, a draw past the refill that came back blank would be all zero
+        assert(static_cast<size_t>(std::count(buffer.begin() + 8, buffer.begin() + 8 + len, 0)) < len / 32 + 8);
+    }
+}
+void queuelimitstest()
+{
+    std::cout << "Starting queue limits test..." << std::endl;
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    std::shared_ptr<SL::WS_LITE::IWSHub> listenerctx;
+    std::atomic<int> received(0);
+    std::atomic<bool> gotlast(false);
+    std::atomic<unsigned short> closecode(0);
+    auto nocompress = SL::WS_LITE::CompressionOptions::NO_COMPRESSION;
+    SL::WS_LITE::PortNumber port(3013);
+    listenerctx =
+        SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+            ->NoTLS()
+            ->CreateListener(port)
+            ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                lastheard = std::chrono::high_resolution_clock::now();
+                // nothing is written until this handler returns, so every send below counts against the limits
+                size_t queued = 0;
+                for (auto i = 0; i < 6; i++) {
+                    auto status = socket->send("x", SL::WS_LITE::OpCode::TEXT, nocompress);
+                    queued += status == SL::WS_LITE::SendStatus::QUEUED ? 1 : 0;
+                    assert(status == SL::WS_LITE::SendStatus::QUEUED || status == SL::WS_LITE::SendStatus::REJECTED);
+                }
+                assert(queued == 4);
+                socket->set_MaxQueuedMessages(5);
+                assert(socket->send("x", SL::WS_LITE::OpCode::TEXT, nocompress) == SL::WS_LITE::SendStatus::QUEUED);
+                assert(socket->send("x", SL::WS_LITE::OpCode::TEXT, nocompress) == SL::WS_LITE::SendStatus::REJECTED);
+                listenerctx->set_OverflowPolicy(SL::WS_LITE::OverflowPolicy::DROP_NEWEST);
+                assert(socket->send("x", SL::WS_LITE::OpCode::TEXT, nocompress) == SL::WS_LITE::SendStatus::DROPPED);
+                // one of the five queued before it makes room
+                listenerctx->set_OverflowPolicy(SL::WS_LITE::OverflowPolicy::DROP_OLDEST);
+                assert(socket->send("last", SL::WS_LITE::OpCode::TEXT, nocompress) == SL::WS_LITE::SendStatus::QUEUED);
+            })
+            ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                lastheard = std::chrono::high_resolution_clock::now();
+                listenerctx->set_OverflowPolicy(SL::WS_LITE::OverflowPolicy::CLOSE_TRY_AGAIN_LATER);
+                auto status = SL::WS_LITE::SendStatus::QUEUED;
+                for (auto i = 0; i < 6 && status == SL::WS_LITE::SendStatus::QUEUED; i++) {
+                    status = socket->send("x", SL::WS_LITE::OpCode::TEXT, nocompress);
+                }
+                assert(status == SL::WS_LITE::SendStatus::CLOSING);
+            })
+            ->listen();
+    listenerctx->set_MaxQueuedMessages(4);
+    assert(listenerctx->get_MaxQueuedMessages() == 4);
+    assert(listenerctx->get_OverflowPolicy() == SL::WS_LITE::OverflowPolicy::REJECT);
+
+    auto clientctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                         ->NoTLS()
+                         ->CreateClient()
+                         ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             received += 1;
+                             if (std::string(reinterpret_cast<const char *>(message.data), message.len) == "last") {
+                                 gotlast = true;
+                                 socket->send("overflow", SL::WS_LITE::OpCode::TEXT, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+                             }
+                         })
+                         ->onDisconnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, unsigned short code, const std::string &msg) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             closecode = code;
+                         })
+                         ->connect("localhost", port);
+    while (closecode == 0 && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    assert(gotlast);
+    assert(closecode != 0);
+    auto stats = listenerctx->get_Statistics();
+    assert(stats.SendsRejected == 3);
+    assert(stats.MessagesDropped == 2);
+    assert(stats.OverflowCloses == 1);
+    // five of the first batch got through, whatever the close did not overtake of the last one may have as well
+    assert(received >= 5);
+}
+void draintest()
+{
+    std::cout << "Starting drain test..." << std::endl;
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    const size_t chunksize = 1024 * 16;
+    const size_t total = 1024 * 1024 * 4;
+    const size_t high = 1024 * 64;
+    std::atomic<size_t> sent(0), received(0), drains(0), maxbuffered(0);
+    auto chunk = SL::WS_LITE::AllocateBuffer(chunksize);
+    memset(chunk.get(), 'd', chunksize);
+    // only ever called on the thread of the socket
+    auto pump = [&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket) {
+        while (sent < total && socket->BufferedBytes() <= high) {
+            SL::WS_LITE::WSMessage msg;
+            msg.Buffer = chunk;
+            msg.data = chunk.get();
+            msg.len = chunksize;
+            msg.code = SL::WS_LITE::OpCode::BINARY;
+            socket->send(msg, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+            sent += chunksize;
+            maxbuffered = std::max<size_t>(maxbuffered, socket->BufferedBytes());
+        }
+    };
+    SL::WS_LITE::PortNumber port(3014);
+    auto listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                           ->NoTLS()
+                           ->CreateListener(port)
+                           ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               socket->set_Watermarks(high, high / 4);
+                               pump(socket);
+                           })
+                           ->onDrain([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               assert(socket->BufferedBytes() <= high / 4);
+                               drains += 1;
+                               pump(socket);
+                           })
+                           ->listen();
+    auto clientctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                         ->NoTLS()
+                         ->CreateClient()
+                         ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             received += message.len;
+                         })
+                         ->connect("localhost", port);
+    while (received < total && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    assert(received == total);
+    assert(drains > 0);
+    // the producer never got more than a chunk ahead of the high watermark
+    assert(maxbuffered <= high + chunksize);
+}
+void outboxtest()
+{
+    std::cout << "Starting outbox test..." << std::endl;
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    const int producers = 4;
+    const int permessages = 5000;
+    std::vector<int> next(producers, 0);
+    std::atomic<int> received(0);
+    std::atomic<bool> connected(false);
+    std::shared_ptr<SL::WS_LITE::IWebSocket> clientsocket;
+
+    SL::WS_LITE::PortNumber port(3015);
+    auto listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                           ->NoTLS()
+                           ->CreateListener(port)
+                           ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               // messages of one producer arrive in the order it sent them
+                               std::string text(reinterpret_cast<const char *>(message.data), message.len);
+                               auto producer = std::stoi(text.substr(0, text.find(':')));
+                               assert(std::stoi(text.substr(text.find(':') + 1)) == next[producer]);
+                               next[producer] += 1;
+                               received += 1;
+                           })
+                           ->listen();
+    auto clientctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                         ->NoTLS()
+                         ->CreateClient()
+                         ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                             clientsocket = socket;
+                             connected = true;
+                         })
+                         ->connect("localhost", port);
+    while (!connected && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    assert(connected);
+    std::vector<std::thread> threads;
+    for (auto p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+            for (auto i = 0; i < permessages; i++) {
+                auto text = std::to_string(p) + ":" + std::to_string(i);
+                clientsocket->send(text, SL::WS_LITE::OpCode::TEXT, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    lastheard = std::chrono::high_resolution_clock::now();
+    while (received < producers * permessages &&
+           std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    assert(received == producers * permessages);
+    clientsocket.reset(); // sockets cannot outlive their hub
+}
+void reassemblytest()
+{
+    std::cout << "Starting reassembly test..." << std::endl;
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    // the first message arrives in 1000 fragments, the smaller second one reuses the buffer the first grew
+    std::vector<std::string> messages = {std::string(100 * 1000, 'a'), std::string(5000, 'b')};
+    for (size_t i = 0; i < messages[0].size(); i++) {
+        messages[0][i] = static_cast<char>('a' + i % 26);
+    }
+    std::atomic<size_t> received(0);
+
+    SL::WS_LITE::PortNumber port(3016);
+    auto listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                           ->NoTLS()
+                           ->CreateListener(port)
+                           ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               assert(std::string(reinterpret_cast<const char *>(message.data), message.len) == messages[received]);
+                               received += 1;
+                           })
+                           ->listen();
+    auto clientctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                         ->NoTLS()
+                         ->CreateClient()
+                         ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             for (auto &msg : messages) {
+                                 socket->send(msg, SL::WS_LITE::OpCode::TEXT, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+                             }
+                         })
+                         ->connect("localhost", port);
+    clientctx->set_MaxFrameSize(100);
+    while (received < messages.size() &&
+           std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    assert(received == messages.size());
+    assert(listenerctx->get_Statistics().FramesReceived >= 1000 + 50);
+}
+void streamingtest()
+{
+    std::cout << "Starting streaming test..." << std::endl;
+    // text split at every position still validates, and a broken sequence does not
+    const std::string text = "h\xc3\xa9llo w\xe2\x82\xacrld \xf0\x9f\x98\x80!";
+    for (size_t split = 0; split <= text.size(); split++) {
+        SL::WS_LITE::Utf8Validator validator;
+        auto p = reinterpret_cast<const unsigned char *>(text.data());
+        assert(validator.validate(p, split, false));
+        assert(validator.validate(p + split, text.size() - split, true));
+    }
+    SL::WS_LITE::Utf8Validator truncated;
+    assert(!truncated.validate(reinterpret_cast<const unsigned char *>(text.data()), text.size() - 2, true));
+
+    // a deflated message inflated piece by piece comes out whole
+    std::string big;
+    for (auto i = 0; i < 100000; i++) {
+        big += std::to_string(i);
+    }
+    std::vector<unsigned char> deflated(compressBound(static_cast<uLong>(big.size())));
+    z_stream strm = {};
+    deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    strm.next_in = reinterpret_cast<Bytef *>(&big[0]);
+    strm.avail_in = static_cast<uInt>(big.size());
+    strm.next_out = deflated.data();
+    strm.avail_out = static_cast<uInt>(deflated.size());
+    deflate(&strm, Z_SYNC_FLUSH);
+    deflated.resize(deflated.size() - strm.avail_out - 4); // permessage-deflate drops the 00 00 ff ff tail
+    deflateEnd(&strm);
+    deflated.insert(deflated.end(), {0x00, 0x00, 0xff, 0xff});
+    SL::WS_LITE::WebSocketContext context;
+    SL::WS_LITE::SocketInflater inflater;
+    inflater.Budget = std::make_shared<SL::WS_LITE::InflateBudget>();
+    std::string inflated;
+    auto finals = 0;
+    for (size_t offset = 0; offset < deflated.size(); offset += 1000) {
+        auto len = std::min<size_t>(1000, deflated.size() - offset);
+        auto last = offset + len == deflated.size();
+        assert(context.InflateChunk(inflater.get(), deflated.data() + offset, len, last, [&](unsigned char *data, size_t l, bool final) {
+            inflated.append(reinterpret_cast<const char *>(data), l);
+            finals += final ? 1 : 0;
+            return true;
+        }));
+    }
+    assert(inflated == big);
+    assert(finals == 1);
+    // the zlib state came from the pool and was counted
+    assert(inflater.Budget->Used > 0);
+    inflater.release();
+    assert(inflater.Budget->Used == 0);
+
+    // both directions: the client to server message is masked, the server to client ones are fragmented
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    std::string message;
+    for (auto i = 0; i < 30000; i++) {
+        message += "caf\xc3\xa9 \xe2\x82\xac ";
+    }
+    const std::string binary(200000, '\x01');
+    std::string serverbuffer, clientbuffer;
+    std::atomic<int> serverchunks(0), clientmessages(0);
+    SL::WS_LITE::PortNumber port(3017);
+    auto listenerctx =
+        SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+            ->NoTLS()
+            ->CreateListener(port)
+            ->onMessageChunk([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const unsigned char *data, size_t len,
+                                 SL::WS_LITE::OpCode code, bool final) {
+                lastheard = std::chrono::high_resolution_clock::now();
+                assert(code == SL::WS_LITE::OpCode::TEXT);
+                serverbuffer.append(reinterpret_cast<const char *>(data), len);
+                serverchunks += 1;
+                if (final) {
+                    assert(serverbuffer == message);
+                    socket->send(message, SL::WS_LITE::OpCode::TEXT, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+                    socket->send(binary, SL::WS_LITE::OpCode::BINARY, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+                }
+            })
+            ->listen();
+    listenerctx->set_MaxFrameSize(50000);
+    auto clientctx =
+        SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+            ->NoTLS()
+            ->CreateClient()
+            ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                lastheard = std::chrono::high_resolution_clock::now();
+                socket->send(message, SL::WS_LITE::OpCode::TEXT, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+            })
+            ->onMessageChunk([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const unsigned char *data, size_t len,
+                                 SL::WS_LITE::OpCode code, bool final) {
+                lastheard = std::chrono::high_resolution_clock::now();
+                clientbuffer.append(reinterpret_cast<const char *>(data), len);
+                if (final) {
+                    assert(clientbuffer == (clientmessages == 0 ? message : binary));
+                    assert(code == (clientmessages == 0 ? SL::WS_LITE::OpCode::TEXT : SL::WS_LITE::OpCode::BINARY));
+                    clientbuffer.clear();
+                    clientmessages += 1;
+                }
+            })
+            ->connect("localhost", port);
+    while (clientmessages < 2 && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    assert(clientmessages == 2);
+    assert(serverchunks > 1);
+}
 const auto bufferesize = 1024 * 1024 * 10;
 void multithreadthroughputtest()
 {
@@ -395,7 +1258,601 @@ void multithreadthroughputtest()
     std::this_thread::sleep_for(200ms);
     std::cout << "Received " << mbsreceived << "  bytes" << std::endl;
 }
+void maskingbenchmark()
+{
+    std::cout << "Starting masking benchmark..." << std::endl;
+    const unsigned char mask[4] = {0x12, 0x34, 0x56, 0x78};
+    for (size_t size : {size_t(1024), size_t(1024 * 64), size_t(1024 * 1024 * 10)}) {
+        std::vector<unsigned char> src(size), bytewise(size), vectorized(size);
+        for (size_t i = 0; i < size; i++) {
+            src[i] = static_cast<unsigned char>(i * 31);
+        }
+        auto iterations = std::max<size_t>((1024 * 1024 * 200) / size, 1);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t it = 0; it < iterations; it++) {
+            auto p = bytewise.data();
+            for (size_t i = 0; i < size; i++) {
+                *p++ = src[i] ^ mask[i % 4];
+            }
+        }
+        auto bytetime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+        start = std::chrono::high_resolution_clock::now();
+        for (size_t it = 0; it < iterations; it++) {
+            SL::WS_LITE::ApplyMask(vectorized.data(), src.data(), size, mask);
+        }
+        auto vectortime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        assert(bytewise == vectorized);
+
+        // masking in unaligned pieces must give the same result as masking in one go
+        std::vector<unsigned char> pieces(size);
+        SL::WS_LITE::ApplyMask(pieces.data(), src.data(), 7, mask);
+        SL::WS_LITE::ApplyMask(pieces.data() + 7, src.data() + 7, size - 7, mask, 7);
+        assert(pieces == bytewise);
+
+        // what the server used to do on receive: the mask key read in front of the payload, which was shifted down while unmasking,
+        // against unmasking in place with the key kept in the header
+        std::vector<unsigned char> framed(size + 4);
+        memcpy(framed.data(), mask, 4);
+        start = std::chrono::high_resolution_clock::now();
+        for (size_t it = 0; it < iterations; it++) {
+            memcpy(framed.data() + 4, src.data(), size);
+            for (size_t c = 4; c < size + 4; c++) {
+                framed[c - 4] = framed[c] ^ mask[c % 4];
+            }
+        }
+        auto shifttime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        std::vector<unsigned char> inplace(size);
+        start = std::chrono::high_resolution_clock::now();
+        for (size_t it = 0; it < iterations; it++) {
+            memcpy(inplace.data(), src.data(), size);
+            SL::WS_LITE::ApplyMask(inplace.data(), inplace.data(), size, mask);
+        }
+        auto inplacetime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        assert(std::equal(bytewise.begin(), bytewise.end(), framed.begin()));
+        assert(inplace == bytewise);
+
+        std::cout << size << " byte payloads: byte loop " << bytetime << "us, ApplyMask " << vectortime << "us, receive shift " << shifttime
+                  << "us, receive in place " << inplacetime << "us for " << iterations << " iterations" << std::endl;
+    }
+}
 #include <sstream>
+void controlframetest()
+{
+    std::cout << "Starting control frame test..." << std::endl;
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    const int pings = 50;
+    std::vector<std::string> pinged, ponged;
+    std::mutex lock;
+    SL::WS_LITE::PortNumber port(3018);
+    auto listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                           ->NoTLS()
+                           ->CreateListener(port)
+                           ->onPing([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const unsigned char *payload, size_t length) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               std::lock_guard<std::mutex> guard(lock);
+                               pinged.emplace_back(reinterpret_cast<const char *>(payload), length);
+                           })
+                           ->listen();
+    auto clientctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                         ->NoTLS()
+                         ->CreateClient()
+                         ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             // sent back to back, so the listener has to answer while earlier pongs are still queued
+                             for (auto i = 0; i < pings; i++) {
+                                 auto payload = "ping " + std::to_string(i) + std::string(i, 'x');
+                                 SL::WS_LITE::WSMessage msg;
+                                 msg.Buffer = SL::WS_LITE::AllocateBuffer(payload.size());
+                                 msg.len = payload.size();
+                                 msg.code = SL::WS_LITE::OpCode::PING;
+                                 msg.data = msg.Buffer.get();
+                                 memcpy(msg.data, payload.data(), payload.size());
+                                 socket->send(msg, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+                             }
+                         })
+                         ->onPong([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const unsigned char *payload, size_t length) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             std::lock_guard<std::mutex> guard(lock);
+                             ponged.emplace_back(reinterpret_cast<const char *>(payload), length);
+                         })
+                         ->connect("localhost", port);
+    auto done = [&] {
+        std::lock_guard<std::mutex> guard(lock);
+        return ponged.size() == pings;
+    };
+    while (!done() && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    assert(pinged.size() == pings);
+    assert(ponged.size() == pings);
+    for (auto i = 0; i < pings; i++) {
+        auto payload = "ping " + std::to_string(i) + std::string(i, 'x');
+        assert(pinged[i] == payload);
+        assert(ponged[i] == payload);
+    }
+}
+void handlerthreadstest()
+{
+    std::cout << "Starting handler threads test..." << std::endl;
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    const int count = 500;
+    std::atomic<int> next(0);
+    std::atomic<bool> ordered(true), offiothread(true), disconnected(false);
+    std::thread::id iothread;
+    SL::WS_LITE::WSMessage kept = {};
+    std::shared_ptr<SL::WS_LITE::IWebSocket> clientsocket;
+    SL::WS_LITE::PortNumber port(3019);
+    auto listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                           ->NoTLS()
+                           ->CreateListener(port)
+                           ->HandlerThreads(SL::WS_LITE::ThreadCount(2))
+                           ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               iothread = std::this_thread::get_id();
+                           })
+                           ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               offiothread = offiothread && std::this_thread::get_id() != iothread;
+                               auto text = std::string(reinterpret_cast<const char *>(message.data), message.len);
+                               ordered = ordered && text == std::to_string(next.load());
+                               if (next == 0) {
+                                   // the message owns its buffer, so it stays valid while later messages arrive
+                                   kept = message;
+                               }
+                               if (next == 0) {
+                                   // the rest of the messages and the close arrive while this one is being handled
+                                   std::this_thread::sleep_for(300ms);
+                               }
+                               next += 1;
+                           })
+                           ->onDisconnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, unsigned short code, const std::string &msg) {
+                               lastheard = std::chrono::high_resolution_clock::now();
+                               // runs after every message of the socket was handled
+                               disconnected = next == count;
+                           })
+                           ->listen();
+    auto clientctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                         ->NoTLS()
+                         ->CreateClient()
+                         ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             for (auto i = 0; i < count; i++) {
+                                 socket->send(std::to_string(i), SL::WS_LITE::OpCode::TEXT, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+                             }
+                             clientsocket = socket;
+                         })
+                         ->connect("localhost", port);
+    while (listenerctx->get_Statistics().FramesReceived < count &&
+           std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(10ms);
+    }
+    // every message has reached the listener, so the close cannot overtake them
+    clientsocket->close(1000, "done");
+    while (!disconnected && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    assert(disconnected);
+    assert(next == count);
+    assert(ordered);
+    assert(offiothread);
+    assert(kept.Buffer && kept.data == kept.Buffer.get());
+    assert(std::string(reinterpret_cast<const char *>(kept.data), kept.len) == "0");
+}
+void deflatetest()
+{
+    std::cout << "Starting deflate test..." << std::endl;
+    std::string json;
+    for (auto i = 0; i < 200; i++) {
+        json += "{\"id\":" + std::to_string(i) + ",\"name\":\"websocket\",\"tags\":[\"a\",\"b\"]},";
+    }
+    auto tomessage = [](std::string &text) {
+        SL::WS_LITE::WSMessage msg = {};
+        msg.data = reinterpret_cast<unsigned char *>(&text[0]);
+        msg.len = text.size();
+        msg.code = SL::WS_LITE::OpCode::TEXT;
+        return msg;
+    };
+    auto inflate = [](z_stream &strm, const SL::WS_LITE::WSMessage &msg) {
+        std::vector<unsigned char> in(msg.data, msg.data + msg.len);
+        in.insert(in.end(), {0x00, 0x00, 0xff, 0xff});
+        std::string out(1024 * 1024, '\0');
+        strm.next_in = in.data();
+        strm.avail_in = static_cast<uInt>(in.size());
+        strm.next_out = reinterpret_cast<Bytef *>(&out[0]);
+        strm.avail_out = static_cast<uInt>(out.size());
+        assert(::inflate(&strm, Z_SYNC_FLUSH) == Z_OK);
+        out.resize(out.size() - strm.avail_out);
+        return out;
+    };
+    // with context takeover later messages refer back to earlier ones, so the peer has to inflate them in order with one stream
+    SL::WS_LITE::MessageDeflater takeover;
+    z_stream peer = {};
+    inflateInit2(&peer, -MAX_WBITS);
+    size_t firstsize = 0;
+    for (auto i = 0; i < 3; i++) {
+        auto deflated = takeover.deflate(tomessage(json), 9, 9, 15, false);
+        assert(deflated.Buffer && deflated.len < json.size());
+        assert(inflate(peer, deflated) == json);
+        if (i == 0) {
+            firstsize = deflated.len;
+        }
+        else {
+            assert(deflated.len < firstsize / 4);
+        }
+    }
+    inflateEnd(&peer);
+    // without it every message stands alone, and one that does not shrink is sent as is
+    SL::WS_LITE::MessageDeflater notakeover;
+    for (auto i = 0; i < 2; i++) {
+        auto deflated = notakeover.deflate(tomessage(json), Z_DEFAULT_COMPRESSION, 8, 15, true);
+        z_stream fresh = {};
+        inflateInit2(&fresh, -MAX_WBITS);
+        assert(inflate(fresh, deflated) == json);
+        inflateEnd(&fresh);
+    }
+    std::string noise(4096, '\0');
+    SL::WS_LITE::RandomPool random;
+    random.get(reinterpret_cast<unsigned char *>(&noise[0]), noise.size());
+    assert(!notakeover.deflate(tomessage(noise), Z_DEFAULT_COMPRESSION, 8, 15, true).Buffer);
+
+    SL::WS_LITE::PortNumber port(3020);
+    auto listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(2))->NoTLS()->CreateListener(port)->listen();
+    assert(listenerctx->get_CompressionLevel() == Z_DEFAULT_COMPRESSION);
+    assert(listenerctx->get_CompressionMemLevel() == 8);
+    listenerctx->set_CompressionLevel(1);
+    listenerctx->set_CompressionMemLevel(4);
+    assert(listenerctx->get_CompressionLevel() == 1);
+    assert(listenerctx->get_CompressionMemLevel() == 4);
+}
+void negotiationtest()
+{
+    std::cout << "Starting negotiation test..." << std::endl;
+    std::string offer("x-webkit-deflate-frame, permessage-deflate; client_max_window_bits; server_max_window_bits=\"10\"; server_no_context_takeover");
+    SL::WS_LITE::ExtensionsParser parsed(offer.data(), offer.size());
+    assert(parsed.perMessageDeflate);
+    assert(parsed.serverNoContextTakeover && !parsed.clientNoContextTakeover);
+    assert(parsed.serverMaxWindowBits == 10 && parsed.clientMaxWindowBits == 1);
+
+    SL::WS_LITE::DeflateSettings server;
+    server.DecompressionNoContextTakeover = true;
+    server.CompressionWindowBits = 12;
+    server.DecompressionWindowBits = 11;
+    SL::WS_LITE::DeflateParameters agreed;
+    std::string response;
+    // the client's limit on the server window wins when it is smaller, the server's own limit on the client needs client_max_window_bits
+    assert(SL::WS_LITE::AcceptDeflateOffer("permessage-deflate; client_max_window_bits; server_max_window_bits=10", server, agreed, response));
+    assert(agreed.ServerMaxWindowBits == 10 && agreed.ClientMaxWindowBits == 11);
+    assert(agreed.ClientNoContextTakeover && !agreed.ServerNoContextTakeover);
+    assert(response == "permessage-deflate; client_no_context_takeover; server_max_window_bits=10; client_max_window_bits=11");
+    assert(SL::WS_LITE::AcceptDeflateOffer("permessage-deflate", server, agreed, response));
+    assert(agreed.ServerMaxWindowBits == 12 && agreed.ClientMaxWindowBits == 15);
+    assert(!SL::WS_LITE::AcceptDeflateOffer("permessage-deflate; server_max_window_bits", server, agreed, response));
+    assert(!SL::WS_LITE::AcceptDeflateOffer("permessage-deflate; client_max_window_bits=16", server, agreed, response));
+    assert(!SL::WS_LITE::AcceptDeflateOffer("x-webkit-deflate-frame", server, agreed, response));
+    // unknown, repeated or malformed parameters decline the offer, the next offer is still considered
+    assert(!SL::WS_LITE::AcceptDeflateOffer("permessage-deflate; x-unknown", server, agreed, response));
+    assert(!SL::WS_LITE::AcceptDeflateOffer("permessage-deflate; server_no_context_takeover; server_no_context_takeover", server, agreed, response));
+    assert(!SL::WS_LITE::AcceptDeflateOffer("permessage-deflate; client_no_context_takeover=1", server, agreed, response));
+    assert(!SL::WS_LITE::AcceptDeflateOffer("permessage-deflate; server_max_window_bits=99999999999999999999", server, agreed, response));
+    assert(!SL::WS_LITE::AcceptDeflateOffer("permessage-deflate; server_max_window_bits=0010", server, agreed, response));
+    assert(!SL::WS_LITE::AcceptDeflateOffer("permessage-deflate; server_max_window_bits=1x", server, agreed, response));
+    assert(SL::WS_LITE::AcceptDeflateOffer("permessage-deflate; x-unknown, permessage-deflate; client_max_window_bits", server, agreed, response));
+    assert(agreed.ClientMaxWindowBits == 11);
+
+    SL::WS_LITE::DeflateSettings client;
+    client.DecompressionNoContextTakeover = true;
+    client.DecompressionWindowBits = 10;
+    assert(SL::WS_LITE::CreateDeflateOffer(client) ==
+           "permessage-deflate; client_max_window_bits; server_max_window_bits=10; server_no_context_takeover");
+    assert(SL::WS_LITE::ReadDeflateResponse("permessage-deflate; server_no_context_takeover; server_max_window_bits=9; client_max_window_bits=12",
+                                            client, agreed));
+    assert(agreed.ServerMaxWindowBits == 9 && agreed.ClientMaxWindowBits == 12 && agreed.ServerNoContextTakeover);
+    // a server that ignores what the client asked of it fails the connection
+    assert(!SL::WS_LITE::ReadDeflateResponse("permessage-deflate; server_no_context_takeover", client, agreed));
+    assert(!SL::WS_LITE::ReadDeflateResponse("permessage-deflate; server_max_window_bits=10", client, agreed));
+    assert(!SL::WS_LITE::ReadDeflateResponse("permessage-deflate; server_no_context_takeover; server_max_window_bits=9; x-unknown", client, agreed));
+
+    // both ends negotiate small windows and send compressed messages each way
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    std::string json;
+    for (auto i = 0; i < 2000; i++) {
+        json += "{\"id\":" + std::to_string(i) + ",\"name\":\"websocket\"},";
+    }
+    // a prepared message deflated once with a full window reaches back further than these peers can look. The client streams
+    // messages, so its inflater has to make do with its window where the output is split into pieces
+    std::string block(2000, '\0');
+    SL::WS_LITE::RandomPool random;
+    random.get(reinterpret_cast<unsigned char *>(&block[0]), block.size());
+    std::string repeated;
+    for (auto i = 0; i < 40; i++) {
+        repeated += block;
+    }
+    SL::WS_LITE::WSMessage preparedmsg;
+    preparedmsg.Buffer = std::shared_ptr<unsigned char>(new unsigned char[repeated.size()], [](unsigned char *p) { delete[] p; });
+    preparedmsg.data = preparedmsg.Buffer.get();
+    preparedmsg.len = repeated.size();
+    preparedmsg.code = SL::WS_LITE::OpCode::BINARY;
+    memcpy(preparedmsg.data, repeated.data(), repeated.size());
+    auto prepared = SL::WS_LITE::CreatePreparedMessage(preparedmsg, SL::WS_LITE::CompressionOptions::COMPRESS);
+    assert(prepared->Compressed.Buffer);
+    std::atomic<int> echoed(0), preparedreceived(0);
+    std::string extensions, streamed;
+    SL::WS_LITE::PortNumber port(3021);
+    auto listenerctx =
+        SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+            ->NoTLS()
+            ->CreateListener(port, SL::WS_LITE::NetworkProtocol::IPV4, SL::WS_LITE::ExtensionOptions::DEFLATE)
+            ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                lastheard = std::chrono::high_resolution_clock::now();
+                socket->send(message.data, message.len, message.code, SL::WS_LITE::CompressionOptions::COMPRESS);
+                socket->send(prepared);
+            })
+            ->listen();
+    listenerctx->set_CompressionWindowBits(10);
+    listenerctx->set_DecompressionWindowBits(10);
+    assert(listenerctx->get_CompressionWindowBits() == 10 && listenerctx->get_DecompressionWindowBits() == 10);
+    auto clientctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                         ->NoTLS()
+                         ->CreateClient(SL::WS_LITE::ExtensionOptions::DEFLATE)
+                         ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             for (auto &h : header.Values) {
+                                 if (h.Key == "Sec-WebSocket-Extensions") {
+                                     extensions = std::string(h.Value);
+                                 }
+                             }
+                             for (auto i = 0; i < 3; i++) {
+                                 socket->send(json, SL::WS_LITE::OpCode::TEXT, SL::WS_LITE::CompressionOptions::COMPRESS);
+                             }
+                         })
+                         ->onMessageChunk([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const unsigned char *data, size_t len,
+                                              SL::WS_LITE::OpCode code, bool final) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             streamed.append(reinterpret_cast<const char *>(data), len);
+                             if (!final) {
+                                 return;
+                             }
+                             auto received = std::move(streamed);
+                             streamed.clear();
+                             if (code == SL::WS_LITE::OpCode::BINARY) {
+                                 assert(received == repeated);
+                                 preparedreceived += 1;
+                             }
+                             else {
+                                 assert(received == json);
+                                 echoed += 1;
+                             }
+                         })
+                         ->connect("localhost", port);
+    while ((echoed < 3 || preparedreceived < 3) && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    assert(echoed == 3);
+    assert(preparedreceived == 3);
+    assert(extensions.find("server_max_window_bits=10") != std::string::npos);
+    assert(extensions.find("client_max_window_bits=10") != std::string::npos);
+}
+void inflatebudgettest()
+{
+    std::cout << "Starting inflate budget test..." << std::endl;
+    std::string json;
+    for (auto i = 0; i < 200; i++) {
+        json += "{\"id\":" + std::to_string(i) + ",\"name\":\"websocket\"},";
+    }
+    SL::WS_LITE::PortNumber port(3022);
+    auto listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                           ->NoTLS()
+                           ->CreateListener(port, SL::WS_LITE::NetworkProtocol::IPV4, SL::WS_LITE::ExtensionOptions::DEFLATE)
+                           ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::WSMessage &message) {
+                               socket->send(message.data, message.len, message.code, SL::WS_LITE::CompressionOptions::NO_COMPRESSION);
+                           })
+                           ->listen();
+    struct Peer {
+        std::atomic<int> Echoed{0};
+        std::atomic<int> Closed{0};
+        std::string Extensions;
+        std::shared_ptr<SL::WS_LITE::IWSHub> Hub;
+    };
+    auto connect = [&](Peer &peer) {
+        peer.Hub = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                       ->NoTLS()
+                       ->CreateClient(SL::WS_LITE::ExtensionOptions::DEFLATE)
+                       ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &header) {
+                           for (auto &h : header.Values) {
+                               if (h.Key == "Sec-WebSocket-Extensions") {
+                                   peer.Extensions = std::string(h.Value);
+                               }
+                           }
+                           socket->send(json, SL::WS_LITE::OpCode::TEXT, SL::WS_LITE::CompressionOptions::COMPRESS);
+                       })
+                       ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &, const SL::WS_LITE::WSMessage &message) {
+                           assert(std::string(reinterpret_cast<const char *>(message.data), message.len) == json);
+                           peer.Echoed += 1;
+                       })
+                       ->onDisconnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &, unsigned short code, const std::string &) {
+                           peer.Closed = code;
+                       })
+                       ->connect("localhost", port);
+    };
+    auto waitfor = [](const std::function<bool()> &done) {
+        auto start = std::chrono::high_resolution_clock::now();
+        while (!done() && std::chrono::high_resolution_clock::now() - start < 3s) {
+            std::this_thread::sleep_for(20ms);
+        }
+        return done();
+    };
+
+    // the first socket keeps its window, and the budget leaves room for only one
+    Peer first, second, third;
+    connect(first);
+    assert(waitfor([&] { return first.Echoed == 1; }));
+    assert(first.Extensions.find("no_context_takeover") == std::string::npos);
+    auto window = listenerctx->get_Statistics().InflateMemory;
+    assert(window > 0);
+    listenerctx->set_InflateMemoryBudget(window + window / 2);
+    assert(listenerctx->get_InflateMemoryBudget() == window + window / 2);
+
+    // the second one takes it over, the first is idle and gets closed
+    connect(second);
+    assert(waitfor([&] { return second.Echoed == 1 && first.Closed != 0; }));
+    assert(listenerctx->get_Statistics().InflateEvictions == 1);
+    assert(waitfor([&] { return listenerctx->get_Statistics().InflateMemory == window; }));
+
+    // over the budget new connections have to deflate without context takeover
+    listenerctx->set_InflateMemoryBudget(1);
+    connect(third);
+    assert(waitfor([&] { return third.Echoed == 1; }));
+    assert(third.Extensions.find("client_no_context_takeover") != std::string::npos);
+    assert(second.Closed == 0);
+    assert(listenerctx->get_Statistics().InflateEvictions == 1);
+}
+void inflatetest()
+{
+    std::cout << "Starting inflate test..." << std::endl;
+    auto deflateall = [](const std::string &in) {
+        std::vector<unsigned char> out(compressBound(static_cast<uLong>(in.size())) + 16);
+        z_stream strm = {};
+        deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+        strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+        strm.avail_in = static_cast<uInt>(in.size());
+        strm.next_out = out.data();
+        strm.avail_out = static_cast<uInt>(out.size());
+        deflate(&strm, Z_SYNC_FLUSH);
+        out.resize(out.size() - strm.avail_out); // the 00 00 ff ff tail is kept, as receivers put it back
+        deflateEnd(&strm);
+        return out;
+    };
+    SL::WS_LITE::WebSocketContext context;
+    context.MaxPayload = 1024 * 1024;
+
+    // grows from nothing to a message many times the first guess
+    std::string text;
+    for (auto i = 0; i < 100000; i++) {
+        text += std::to_string(i);
+    }
+    auto deflated = deflateall(text);
+    context.beginInflate();
+    auto[data, len, code] = context.Inflate(deflated.data(), deflated.size());
+    assert(code == 0);
+    assert(std::string(reinterpret_cast<const char *>(data), len) == text);
+    // the message can keep the buffer
+    auto kept = context.TakeInflated(data);
+    assert(kept.get() == data);
+    context.endInflate();
+
+    // exactly MaxPayload is fine, a byte more is not, however small it was on the wire
+    auto limit = deflateall(std::string(context.MaxPayload, 'a'));
+    auto[limitdata, limitlen, limitcode] = context.Inflate(limit.data(), limit.size());
+    assert(limitcode == 0 && limitdata && limitlen == context.MaxPayload);
+    auto bomb = deflateall(std::string(context.MaxPayload + 1, 'a'));
+    assert(bomb.size() < 2048);
+    auto[bombdata, bomblen, bombcode] = context.Inflate(bomb.data(), bomb.size());
+    assert(bombcode == 1009 && !bombdata && bomblen == 0);
+
+    // corrupt data fails, and the stream is usable again for the next message
+    std::vector<unsigned char> corrupt = {0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0xff, 0xff};
+    assert(std::get<2>(context.Inflate(corrupt.data(), corrupt.size())) == 1007);
+    auto again = deflateall("again");
+    auto[againdata, againlen, againcode] = context.Inflate(again.data(), again.size());
+    assert(againcode == 0 && std::string(reinterpret_cast<const char *>(againdata), againlen) == "again");
+}
+void compressionpolicytest()
+{
+    std::cout << "Starting compression policy test..." << std::endl;
+    // over the CPU budget of a second the level drops, over twice of it nothing is deflated, and the next second starts over
+    SL::WS_LITE::WebSocketContext context;
+    context.CompressionLevel = 9;
+    auto now = std::chrono::steady_clock::now();
+    assert(context.CompressionLevelNow(now) == 9);
+    context.CompressionCpuBudget = std::chrono::microseconds(100);
+    assert(context.CompressionLevelNow(now) == 9);
+    context.CompressionDone(1000, 100, std::chrono::microseconds(150));
+    assert(context.CompressionLevelNow(now) == Z_BEST_SPEED);
+    context.CompressionDone(1000, 100, std::chrono::microseconds(100));
+    assert(context.CompressionLevelNow(now) == Z_NO_COMPRESSION);
+    assert(context.CompressionLevelNow(now + std::chrono::seconds(1)) == 9);
+    assert(context.MessagesCompressed == 2 && context.CompressionBytesIn == 2000 && context.CompressionMicroseconds == 250);
+
+    // the level of a deflater can change between messages without breaking the stream
+    std::string json;
+    for (auto i = 0; i < 200; i++) {
+        json += "{\"id\":" + std::to_string(i) + ",\"name\":\"websocket\"},";
+    }
+    SL::WS_LITE::MessageDeflater deflater;
+    z_stream peer = {};
+    inflateInit2(&peer, -MAX_WBITS);
+    for (auto level : {9, 1, 6}) {
+        SL::WS_LITE::WSMessage msg = {};
+        msg.data = reinterpret_cast<unsigned char *>(&json[0]);
+        msg.len = json.size();
+        msg.code = SL::WS_LITE::OpCode::TEXT;
+        auto deflated = deflater.deflate(msg, level, 8, 15, false);
+        assert(deflated.Buffer);
+        std::vector<unsigned char> in(deflated.data, deflated.data + deflated.len);
+        in.insert(in.end(), {0x00, 0x00, 0xff, 0xff});
+        std::string out(json.size() * 2, '\0');
+        peer.next_in = in.data();
+        peer.avail_in = static_cast<uInt>(in.size());
+        peer.next_out = reinterpret_cast<Bytef *>(&out[0]);
+        peer.avail_out = static_cast<uInt>(out.size());
+        assert(::inflate(&peer, Z_SYNC_FLUSH) == Z_OK);
+        out.resize(out.size() - peer.avail_out);
+        assert(out == json);
+    }
+    inflateEnd(&peer);
+
+    // tiny messages are not deflated, and a socket stops trying once what it sends does not compress
+    std::string noise(40 * 1024, '\0');
+    SL::WS_LITE::RandomPool random;
+    random.get(reinterpret_cast<unsigned char *>(&noise[0]), noise.size());
+    std::vector<std::string> sent;
+    for (auto i = 0; i < 10; i++) {
+        sent.push_back("tiny " + std::to_string(i));
+    }
+    sent.push_back(json);
+    for (auto i = 0; i < 3; i++) {
+        sent.push_back(noise);
+    }
+    std::atomic<size_t> received(0);
+    auto lastheard = std::chrono::high_resolution_clock::now();
+    SL::WS_LITE::PortNumber port(3023);
+    auto listenerctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                           ->NoTLS()
+                           ->CreateListener(port, SL::WS_LITE::NetworkProtocol::IPV4, SL::WS_LITE::ExtensionOptions::DEFLATE)
+                           ->onConnection([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &socket, const SL::WS_LITE::HttpHeader &) {
+                               for (auto &m : sent) {
+                                   socket->send(m, SL::WS_LITE::OpCode::BINARY, SL::WS_LITE::CompressionOptions::COMPRESS);
+                               }
+                           })
+                           ->listen();
+    assert(listenerctx->get_CompressionThreshold() == 64);
+    assert(listenerctx->get_CompressionCpuBudget().count() == 0);
+    listenerctx->set_CompressionCpuBudget(std::chrono::seconds(1));
+    assert(listenerctx->get_CompressionCpuBudget() == std::chrono::seconds(1));
+    auto clientctx = SL::WS_LITE::CreateContext(SL::WS_LITE::ThreadCount(1))
+                         ->NoTLS()
+                         ->CreateClient(SL::WS_LITE::ExtensionOptions::DEFLATE)
+                         ->onMessage([&](const std::shared_ptr<SL::WS_LITE::IWebSocket> &, const SL::WS_LITE::WSMessage &message) {
+                             lastheard = std::chrono::high_resolution_clock::now();
+                             assert(std::string(reinterpret_cast<const char *>(message.data), message.len) == sent[received]);
+                             received += 1;
+                         })
+                         ->connect("localhost", port);
+    while (received < sent.size() &&
+           std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - lastheard).count() < 2000) {
+        std::this_thread::sleep_for(50ms);
+    }
+    assert(received == sent.size());
+    auto stats = listenerctx->get_Statistics();
+    // the json and the first two blocks of noise, which were enough to see it does not compress
+    assert(stats.MessagesCompressed == 3);
+    assert(stats.CompressionsSkipped == 11);
+    assert(stats.CompressionBytesIn == json.size() + 2 * noise.size());
+    assert(stats.CompressionBytesOut < stats.CompressionBytesIn && stats.CompressionBytesOut > 2 * noise.size());
+}
 void checkexpected(SL::WS_LITE::HttpHeader &header, std::string key, std::string expectedvalue)
 {
     auto t = std::find_if(std::begin(header.Values), std::end(header.Values), [key](SL::WS_LITE::HeaderKeyValue &c) { return c.Key == key; });
@@ -522,6 +1979,7 @@ int main(int argc, char *argv[])
     testkeyvalueparsing();
     testheaderparsing();
     testgetline();
+    maskingbenchmark();
     wssautobahntest();
     std::this_thread::sleep_for(1s);
     generaltest();
@@ -530,6 +1988,27 @@ int main(int argc, char *argv[])
     std::this_thread::sleep_for(1s);
     multithreadtest();
     std::this_thread::sleep_for(1s);
+    batchingtest();
+    fragmentationtest();
+    prioritytest();
+    sendfiletest();
+    preparedmessagetest();
+    pubsubtest();
+    bufferpooltest();
+    randompooltest();
+    queuelimitstest();
+    draintest();
+    outboxtest();
+    reassemblytest();
+    streamingtest();
+    controlframetest();
+    handlerthreadstest();
+    deflatetest();
+    negotiationtest();
+    inflatebudgettest();
+    inflatetest();
+    compressionpolicytest();
+    std::this_thread::sleep_for(1s);
     multithreadthroughputtest();
     return 0;
 }
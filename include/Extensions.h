@@ -1,132 +1,181 @@
 #pragma once
-
+#include "WS_Lite.h"
+#include <cctype>
+#include <cstring>
 #include <string>
+#include <string_view>
+
 namespace SL {
 namespace WS_LITE {
 
-    enum ExtensionTokens {
-        TOK_PERMESSAGE_DEFLATE = 1838,
-        TOK_SERVER_NO_CONTEXT_TAKEOVER = 2807,
-        TOK_CLIENT_NO_CONTEXT_TAKEOVER = 2783,
-        TOK_SERVER_MAX_WINDOW_BITS = 2372,
-        TOK_CLIENT_MAX_WINDOW_BITS = 2348
-    };
-
+    // reads the parameters of the first permessage-deflate offer or response in a Sec-WebSocket-Extensions value, other extensions are
+    // skipped. Window bits are 0 when the parameter is missing, 1 when it has no value. valid is false when the element has a parameter
+    // that is unknown, repeated, out of range or malformed, next points past it so the offers after it can be read
     class ExtensionsParser {
       private:
-        int *lastInteger = nullptr;
+        const char *in;
+        const char *stop;
 
-      public:
-        bool perMessageDeflate = false;
-        bool serverNoContextTakeover = false;
-        bool clientNoContextTakeover = false;
-        int serverMaxWindowBits = 0;
-        int clientMaxWindowBits = 0;
-
-        int getToken(const char *&in, const char *stop)
+        static bool isTokenChar(char c)
+        {
+            return isalnum(static_cast<unsigned char>(c)) || (c != 0 && strchr("!#$%&'*+-.^_`|~", c) != nullptr);
+        }
+        void skipSpace()
         {
-            while (!isalnum(*in) && in != stop) {
+            while (in != stop && (*in == ' ' || *in == '\t')) {
                 in++;
             }
-
-            int hashedToken = 0;
-            while (isalnum(*in) || *in == '-' || *in == '_') {
-                if (isdigit(*in)) {
-                    hashedToken = hashedToken * 10 - (*in - '0');
-                }
-                else {
-                    hashedToken += *in;
-                }
+        }
+        std::string_view token()
+        {
+            skipSpace();
+            auto start = in;
+            while (in != stop && isTokenChar(*in)) {
                 in++;
             }
-            return hashedToken;
+            return std::string_view(start, static_cast<size_t>(in - start));
         }
-        ExtensionsParser(const char *data, size_t length)
+        // a token or a quoted string, without the quotes
+        bool value(std::string_view &v)
         {
-            const char *stop = data + length;
-            int token = 1;
-            for (; token && token != TOK_PERMESSAGE_DEFLATE; token = getToken(data, stop))
-                ;
-
-            perMessageDeflate = (token == TOK_PERMESSAGE_DEFLATE);
-            while ((token = getToken(data, stop))) {
-                switch (token) {
-                case TOK_PERMESSAGE_DEFLATE:
-                    return;
-                case TOK_SERVER_NO_CONTEXT_TAKEOVER:
-                    serverNoContextTakeover = true;
-                    break;
-                case TOK_CLIENT_NO_CONTEXT_TAKEOVER:
-                    clientNoContextTakeover = true;
-                    break;
-                case TOK_SERVER_MAX_WINDOW_BITS:
-                    serverMaxWindowBits = 1;
-                    lastInteger = &serverMaxWindowBits;
-                    break;
-                case TOK_CLIENT_MAX_WINDOW_BITS:
-                    clientMaxWindowBits = 1;
-                    lastInteger = &clientMaxWindowBits;
-                    break;
-                default:
-                    if (token < 0 && lastInteger) {
-                        *lastInteger = -token;
-                    }
-                    break;
+            skipSpace();
+            if (in == stop || *in != '"') {
+                v = token();
+                return !v.empty();
+            }
+            auto start = ++in;
+            while (in != stop && *in != '"') {
+                if (*in == '\\') {
+                    return false; // no parameter of permessage-deflate needs escapes
                 }
+                in++;
+            }
+            if (in == stop) {
+                return false;
             }
+            v = std::string_view(start, static_cast<size_t>(in - start));
+            in++;
+            return true;
         }
-    };
-
-    template <bool isServer> class ExtensionsNegotiator {
-      private:
-        int options;
-
-      public:
-        ExtensionsNegotiator(int wantedOptions) { options = wantedOptions; }
-        std::string generateOffer()
+        // reads the rest of an element, past the ',' that ends it
+        void skipElement()
         {
-            std::string extensionsOffer;
-            if (options & Options::PERMESSAGE_DEFLATE) {
-                extensionsOffer += "permessage-deflate";
-
-                if (options & Options::CLIENT_NO_CONTEXT_TAKEOVER) {
-                    extensionsOffer += "; client_no_context_takeover";
-                }
-
-                if (options & Options::SERVER_NO_CONTEXT_TAKEOVER) {
-                    extensionsOffer += "; server_no_context_takeover";
-                }
+            auto quoted = false;
+            while (in != stop && (quoted || *in != ',')) {
+                quoted = *in == '"' ? !quoted : quoted;
+                in++;
+            }
+            if (in != stop) {
+                in++;
             }
-
-            return extensionsOffer;
         }
-
-        void readOffer(std::string offer)
+        // at most two digits, so nothing can overflow, and 8 to 15 as RFC 7692 allows
+        static int windowBits(std::string_view v)
         {
-            if (isServer) {
-                ExtensionsParser extensionsParser(offer.data(), offer.length());
-                if ((options & PERMESSAGE_DEFLATE) && extensionsParser.perMessageDeflate) {
-                    if (extensionsParser.clientNoContextTakeover || (options & CLIENT_NO_CONTEXT_TAKEOVER)) {
-                        options |= CLIENT_NO_CONTEXT_TAKEOVER;
-                    }
-
-                    if (extensionsParser.serverNoContextTakeover) {
-                        options |= SERVER_NO_CONTEXT_TAKEOVER;
-                    }
-                    else {
-                        options &= ~SERVER_NO_CONTEXT_TAKEOVER;
+            if (v.empty() || v.size() > 2 || !isdigit(static_cast<unsigned char>(v[0])) ||
+                (v.size() == 2 && !isdigit(static_cast<unsigned char>(v[1])))) {
+                return 0;
+            }
+            auto bits = v.size() == 2 ? (v[0] - '0') * 10 + (v[1] - '0') : v[0] - '0';
+            return bits >= 8 && bits <= 15 ? bits : 0;
+        }
+        void parameters()
+        {
+            for (;;) {
+                skipSpace();
+                if (in == stop) {
+                    return;
+                }
+                if (*in == ',') {
+                    in++;
+                    return;
+                }
+                if (*in != ';') {
+                    valid = false;
+                    return skipElement();
+                }
+                in++;
+                auto name = token();
+                std::string_view v;
+                skipSpace();
+                auto hasvalue = in != stop && *in == '=';
+                if (hasvalue) {
+                    in++;
+                    if (!value(v)) {
+                        valid = false;
+                        return skipElement();
                     }
                 }
+                if (name == "server_no_context_takeover" || name == "client_no_context_takeover") {
+                    auto &flag = name[0] == 's' ? serverNoContextTakeover : clientNoContextTakeover;
+                    valid = valid && !flag && !hasvalue;
+                    flag = true;
+                }
+                else if (name == "server_max_window_bits" || name == "client_max_window_bits") {
+                    auto &bits = name[0] == 's' ? serverMaxWindowBits : clientMaxWindowBits;
+                    valid = valid && bits == 0;
+                    bits = hasvalue ? windowBits(v) : 1;
+                    valid = valid && bits != 0;
+                }
                 else {
-                    options &= ~PERMESSAGE_DEFLATE;
+                    valid = false;
                 }
             }
-            else {
-                // todo!
+        }
+
+      public:
+        bool perMessageDeflate = false;
+        bool valid = true;
+        bool serverNoContextTakeover = false;
+        bool clientNoContextTakeover = false;
+        int serverMaxWindowBits = 0;
+        int clientMaxWindowBits = 0;
+        const char *next;
+
+        ExtensionsParser(const char *data, size_t length) : in(data), stop(data + length)
+        {
+            while (in != stop) {
+                if (token() == "permessage-deflate") {
+                    perMessageDeflate = true;
+                    parameters();
+                    break;
+                }
+                skipElement();
             }
+            next = in;
         }
-        int getNegotiatedOptions() { return options; }
     };
 
+    // what this side asks for when permessage-deflate is enabled on a hub
+    struct DeflateSettings {
+        // the window used to deflate what we send, 8 to 15. zlib cannot deflate with 8, so a window of 8 sends uncompressed
+        int CompressionWindowBits = 15;
+        // the largest window the peer may deflate with, 8 to 15. A server can only hold a client to it when the client offers
+        // client_max_window_bits
+        int DecompressionWindowBits = 15;
+        // start every message we deflate with an empty window
+        bool CompressionNoContextTakeover = false;
+        // ask the peer to start every message with an empty window, so no window has to be kept for it between messages. Also asked
+        // while the hub is over its InflateMemoryBudget
+        bool DecompressionNoContextTakeover = false;
+    };
+    // what both sides of a connection agreed to
+    struct DeflateParameters {
+        bool ServerNoContextTakeover = false;
+        bool ClientNoContextTakeover = false;
+        int ServerMaxWindowBits = 15;
+        int ClientMaxWindowBits = 15;
+    };
+
+    // the Sec-WebSocket-Extensions value a client offers
+    WS_LITE_EXTERN std::string CreateDeflateOffer(const DeflateSettings &settings);
+    // the server side of the negotiation. Returns false when offer has no permessage-deflate that can be accepted, otherwise agreed is
+    // filled in and response is the Sec-WebSocket-Extensions value to send back
+    WS_LITE_EXTERN bool AcceptDeflateOffer(std::string_view offer, const DeflateSettings &settings, DeflateParameters &agreed,
+                                           std::string &response);
+    // the client side, with the Sec-WebSocket-Extensions value the server answered with to an offer from CreateDeflateOffer. Returns false
+    // when the response breaks RFC 7692 or what was offered, and the connection has to fail
+    WS_LITE_EXTERN bool ReadDeflateResponse(std::string_view response, const DeflateSettings &settings, DeflateParameters &agreed);
+
 } // namespace WS_LITE
 } // namespace SL
@@ -3,6 +3,7 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <system_error>
 #include <unordered_map>
 #include <vector>
@@ -147,6 +148,19 @@ namespace WS_LITE {
     enum SocketStatus : unsigned char { CONNECTING, CONNECTED, CLOSING, CLOSED };
     enum ExtensionOptions : unsigned char { NO_OPTIONS = 0, DEFLATE = 1 };
     enum class CompressionOptions { COMPRESS, NO_COMPRESSION };
+    // queued frames leave a socket strictly in this order. Ping, pong and close frames are always sent as CONTROL
+    enum class SendPriority { CONTROL, HIGH, NORMAL, BULK };
+    // what became of a message handed to send. INVALID_FILE_REGION is only returned by sendFile, for a region that is empty, runs past the
+    // end of the file or could not be read
+    enum class SendStatus { QUEUED, REJECTED, DROPPED, CLOSING, NOT_CONNECTED, INVALID_FILE_REGION };
+    // what a socket does with a message that would take its outbound queue over its limits. Control frames are never limited
+    enum class OverflowPolicy {
+        REJECT,                 // the message is not queued and send returns REJECTED
+        DROP_OLDEST,            // the message is queued and the oldest messages not yet being written are dropped, lowest priority first
+        DROP_NEWEST,            // the message is not queued and send returns DROPPED
+        CLOSE_POLICY_VIOLATION, // the socket is closed with 1008
+        CLOSE_TRY_AGAIN_LATER   // the socket is closed with 1013
+    };
     enum class NetworkProtocol { IPV4, IPV6 };
 
     struct WSMessage {
@@ -159,6 +173,44 @@ namespace WS_LITE {
         std::shared_ptr<unsigned char> Buffer;
     };
 
+    struct HubStatistics {
+        // number of writes issued to sockets
+        size_t Flushes = 0;
+        // number of frames sent by those writes. FramesFlushed / Flushes is the average number of frames per write
+        size_t FramesFlushed = 0;
+        // number of reads issued to sockets once they were open
+        size_t Reads = 0;
+        // number of frames received. FramesReceived / Reads is the average number of frames per read
+        size_t FramesReceived = 0;
+        // number of published messages queued on subscribers
+        size_t PublishDelivered = 0;
+        // number of published messages a subscriber did not get because too much was still waiting to be written to it
+        size_t PublishSkipped = 0;
+        // number of sends refused by OverflowPolicy::REJECT
+        size_t SendsRejected = 0;
+        // number of messages discarded by OverflowPolicy::DROP_OLDEST and DROP_NEWEST
+        size_t MessagesDropped = 0;
+        // number of sockets closed because their outbound queue overflowed
+        size_t OverflowCloses = 0;
+        // bytes of zlib state held by the inflaters of sockets
+        size_t InflateMemory = 0;
+        // number of sockets closed to keep to the InflateMemoryBudget
+        size_t InflateEvictions = 0;
+        // number of messages deflated, and the bytes that went in and came out. CompressionBytesOut / CompressionBytesIn is the ratio
+        // achieved, messages that did not shrink count as sent uncompressed
+        size_t MessagesCompressed = 0;
+        size_t CompressionBytesIn = 0;
+        size_t CompressionBytesOut = 0;
+        // time spent deflating them
+        size_t CompressionMicroseconds = 0;
+        // number of messages sent uncompressed although COMPRESS was asked for: smaller than the CompressionThreshold, from a socket
+        // whose messages recently did not compress, or over the CompressionCpuBudget
+        size_t CompressionsSkipped = 0;
+    };
+
+    // a message encoded once that can be sent to any number of sockets, see CreatePreparedMessage
+    class PreparedMessage;
+
     class IWebSocket : public std::enable_shared_from_this<IWebSocket> {
       public:
         virtual ~IWebSocket() {}
@@ -168,8 +220,32 @@ namespace WS_LITE {
         virtual bool is_v4() const = 0;
         virtual bool is_v6() const = 0;
         virtual bool is_loopback() const = 0;
+        // bytes queued on this socket that have not been written yet, safe to call from any thread
         virtual size_t BufferedBytes() const = 0;
-        virtual void send(const WSMessage &msg, CompressionOptions compressmessage) = 0;
+        virtual SendStatus send(const WSMessage &msg, CompressionOptions compressmessage, SendPriority priority = SendPriority::NORMAL) = 0;
+        // copies data into a pooled buffer and sends it
+        virtual SendStatus send(std::string_view data, OpCode code, CompressionOptions compressmessage, SendPriority priority = SendPriority::NORMAL) = 0;
+        virtual SendStatus send(const unsigned char *data, size_t len, OpCode code, CompressionOptions compressmessage,
+                                SendPriority priority = SendPriority::NORMAL) = 0;
+        // send a message built by CreatePreparedMessage. Server sockets reuse its frame header and, when permessage-deflate was negotiated,
+        // its compressed payload. Clients have to mask every frame themselves so they only share the payload
+        virtual SendStatus send(const std::shared_ptr<PreparedMessage> &msg, SendPriority priority = SendPriority::NORMAL) = 0;
+        // send length bytes of the open file fd starting at offset as a single message. The descriptor is duplicated, so the caller can
+        // close it right away, but the file must not shrink until the message is sent. Returns INVALID_FILE_REGION if length is 0, the
+        // region runs past the end of the file or the file could not be read, otherwise what became of the message like send
+        virtual SendStatus sendFile(int fd, size_t offset, size_t length, OpCode code, SendPriority priority = SendPriority::NORMAL) = 0;
+        // number of messages waiting to be sent at a priority, including one that is partly written
+        virtual size_t QueuedMessages(SendPriority priority) const = 0;
+        // number of payload bytes waiting to be sent at a priority
+        virtual size_t QueuedBytes(SendPriority priority) const = 0;
+        // limits the bytes waiting to be sent on this socket, overriding the limit of its hub. 0, the default, uses the hub limit
+        virtual void set_MaxQueuedBytes(size_t bytes) = 0;
+        virtual size_t get_MaxQueuedBytes() const = 0;
+        // limits the messages waiting to be sent on this socket, overriding the limit of its hub. 0, the default, uses the hub limit
+        virtual void set_MaxQueuedMessages(size_t count) = 0;
+        virtual size_t get_MaxQueuedMessages() const = 0;
+        // watermarks of this socket in place of those of its hub, see IWSHub::set_HighWatermark
+        virtual void set_Watermarks(size_t high, size_t low) = 0;
         // send a close message and close the socket
         virtual void close(unsigned short code = 1000, const std::string &msg = "") = 0;
     };
@@ -188,6 +264,98 @@ namespace WS_LITE {
         virtual void set_WriteTimeout(std::chrono::seconds seconds) = 0;
         // get the current write timeout in seconds
         virtual std::chrono::seconds get_WriteTimeout() = 0;
+        // the maximum number of payload bytes combined into a single write when several frames are queued on a socket
+        virtual void set_MaxFlushBytes(size_t bytes) = 0;
+        // the maximum number of payload bytes combined into a single write
+        virtual size_t get_MaxFlushBytes() = 0;
+        // the maximum number of buffers handed to a single write. Each frame uses up to two, one for the header and one for the payload
+        virtual void set_MaxFlushBuffers(size_t count) = 0;
+        // the maximum number of buffers handed to a single write
+        virtual size_t get_MaxFlushBuffers() = 0;
+        // messages larger than this are sent as several frames so control frames can go out between them. 0, the default, disables
+        // fragmentation
+        virtual void set_MaxFrameSize(size_t bytes) = 0;
+        // the largest frame payload sent, 0 when fragmentation is disabled
+        virtual size_t get_MaxFrameSize() = 0;
+        // counters summed over all threads of this hub
+        virtual HubStatistics get_Statistics() = 0;
+        // adds a socket of this hub to the subscribers of topic
+        virtual void subscribe(const std::shared_ptr<IWebSocket> &socket, const std::string &topic) = 0;
+        // removes a socket from the subscribers of topic. Sockets are removed from all their topics when they close
+        virtual void unsubscribe(const std::shared_ptr<IWebSocket> &socket, const std::string &topic) = 0;
+        // sends msg to every subscriber of topic. This costs one post per thread of the hub no matter how many subscribers there are
+        virtual void publish(const std::string &topic, const std::shared_ptr<PreparedMessage> &msg) = 0;
+        // subscribers with more than this many bytes waiting to be written skip published messages until they catch up. 0, the default,
+        // never skips
+        virtual void set_MaxPublishBacklog(size_t bytes) = 0;
+        // the backlog above which subscribers skip published messages
+        virtual size_t get_MaxPublishBacklog() = 0;
+        // the most bytes that may wait to be sent on each socket, including the write in flight. 0, the default, is unlimited
+        virtual void set_MaxQueuedBytes(size_t bytes) = 0;
+        // the most bytes that may wait to be sent on each socket
+        virtual size_t get_MaxQueuedBytes() = 0;
+        // the most messages that may wait to be sent on each socket. 0, the default, is unlimited
+        virtual void set_MaxQueuedMessages(size_t count) = 0;
+        // the most messages that may wait to be sent on each socket
+        virtual size_t get_MaxQueuedMessages() = 0;
+        // what to do when a send would go over the queue limits, REJECT by default
+        virtual void set_OverflowPolicy(OverflowPolicy policy) = 0;
+        // what to do when a send would go over the queue limits
+        virtual OverflowPolicy get_OverflowPolicy() = 0;
+        // sockets with more than this many bytes waiting to be sent get an onDrain call once they are back at the low watermark. 1 MB by
+        // default
+        virtual void set_HighWatermark(size_t bytes) = 0;
+        // the pending bytes above which a socket waits for onDrain
+        virtual size_t get_HighWatermark() = 0;
+        // the pending bytes at or below which onDrain is called, 256 KB by default
+        virtual void set_LowWatermark(size_t bytes) = 0;
+        // the pending bytes at or below which onDrain is called
+        virtual size_t get_LowWatermark() = 0;
+        // zlib level used to deflate messages sent with CompressionOptions::COMPRESS, Z_DEFAULT_COMPRESSION (-1) by default. Every
+        // message is deflated with the level set when it starts going out, sockets switch levels between messages and keep their window
+        virtual void set_CompressionLevel(int level) = 0;
+        // the zlib level used to deflate messages
+        virtual int get_CompressionLevel() = 0;
+        // zlib memLevel of the deflate state of each socket, 1 to 9. Higher is faster and compresses better but costs more memory per
+        // socket, 8 by default
+        virtual void set_CompressionMemLevel(int memlevel) = 0;
+        // the zlib memLevel of the deflate state of each socket
+        virtual int get_CompressionMemLevel() = 0;
+        // the permessage-deflate window this hub deflates with, 8 to 15 bits. Negotiated with each peer as server_max_window_bits or
+        // client_max_window_bits, so a smaller window saves memory on every socket. 15 by default
+        virtual void set_CompressionWindowBits(int bits) = 0;
+        // the permessage-deflate window this hub deflates with
+        virtual int get_CompressionWindowBits() = 0;
+        // the largest window peers may deflate with, 8 to 15 bits. Listeners can only hold clients to it that offer client_max_window_bits,
+        // clients ask it of servers, which have to agree or decline permessage-deflate. 15 by default
+        virtual void set_DecompressionWindowBits(int bits) = 0;
+        // the largest window peers may deflate with
+        virtual int get_DecompressionWindowBits() = 0;
+        // deflate every message with an empty window, so nothing is kept between messages. Negotiated as server_no_context_takeover or
+        // client_no_context_takeover, off by default
+        virtual void set_CompressionNoContextTakeover(bool notakeover) = 0;
+        // whether every message is deflated with an empty window
+        virtual bool get_CompressionNoContextTakeover() = 0;
+        // ask peers to deflate every message with an empty window, so no window is kept for them between messages. Negotiated as
+        // client_no_context_takeover or server_no_context_takeover, off by default
+        virtual void set_DecompressionNoContextTakeover(bool notakeover) = 0;
+        // whether peers are asked to deflate every message with an empty window
+        virtual bool get_DecompressionNoContextTakeover() = 0;
+        // bytes of zlib state the sockets of this hub may keep to inflate what their peers send, 0 (the default) is unlimited. Once it is
+        // exceeded new connections are negotiated without context takeover, and the sockets that inflated a message the longest ago are
+        // closed with 1013 until it is met again
+        virtual void set_InflateMemoryBudget(size_t bytes) = 0;
+        // bytes of zlib state the sockets of this hub may keep to inflate what their peers send
+        virtual size_t get_InflateMemoryBudget() = 0;
+        // messages smaller than this are sent uncompressed even when COMPRESS was asked for, 64 bytes by default
+        virtual void set_CompressionThreshold(size_t bytes) = 0;
+        // messages smaller than this are sent uncompressed
+        virtual size_t get_CompressionThreshold() = 0;
+        // time each thread of this hub may spend deflating per second, 0 (the default) is unlimited. Past it messages are deflated with
+        // level 1, past twice that they are sent uncompressed until the second is over
+        virtual void set_CompressionCpuBudget(std::chrono::microseconds budget) = 0;
+        // time each thread of this hub may spend deflating per second
+        virtual std::chrono::microseconds get_CompressionCpuBudget() = 0;
     };
     class WS_LITE_EXTERN IWSListener_Configuration {
       public:
@@ -199,6 +367,11 @@ namespace WS_LITE {
         // when a message has been received
         virtual std::shared_ptr<IWSListener_Configuration>
         onMessage(const std::function<void(const std::shared_ptr<IWebSocket> &, const WSMessage &)> &handle) = 0;
+        // receive text and binary messages in pieces as they arrive instead of whole through onMessage, so a large message does not have
+        // to fit in memory. Compressed messages are inflated piece by piece. The last piece of a message has isFinal set and may be empty.
+        // MaxPayload still limits the size of a message
+        virtual std::shared_ptr<IWSListener_Configuration> onMessageChunk(
+            const std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t, OpCode, bool)> &handle) = 0;
         // when a socket is closed down for ANY reason. If onconnect is called, then a matching onDisconnection is guaranteed
         virtual std::shared_ptr<IWSListener_Configuration>
         onDisconnection(const std::function<void(const std::shared_ptr<IWebSocket> &, unsigned short, const std::string &)> &handle) = 0;
@@ -208,6 +381,13 @@ namespace WS_LITE {
         // when a pong is received from a client
         virtual std::shared_ptr<IWSListener_Configuration>
         onPong(const std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t)> &handle) = 0;
+        // when the bytes waiting to be sent on a socket that went over its high watermark have fallen to its low watermark. Called on the
+        // thread of the socket, so a producer can send more here and keep pace with what the peer reads
+        virtual std::shared_ptr<IWSListener_Configuration> onDrain(const std::function<void(const std::shared_ptr<IWebSocket> &)> &handle) = 0;
+        // run onMessage and onDisconnection on a pool of threadcount worker threads instead of the io threads, so a slow handler does not
+        // hold up the other sockets of its thread. The handlers of one socket still run one at a time and in order. Each message owns its
+        // buffer, keep message.Buffer to use the data after the handler returns. The other handlers stay on the io threads
+        virtual std::shared_ptr<IWSListener_Configuration> HandlerThreads(ThreadCount threadcount) = 0;
         // start the process to listen for clients. This is non-blocking and will return immediatly
         virtual std::shared_ptr<IWSHub> listen(bool no_delay = true, bool reuse_address = true) = 0;
     };
@@ -221,6 +401,11 @@ namespace WS_LITE {
         // when a message has been received
         virtual std::shared_ptr<IWSClient_Configuration>
         onMessage(const std::function<void(const std::shared_ptr<IWebSocket> &, const WSMessage &)> &handle) = 0;
+        // receive text and binary messages in pieces as they arrive instead of whole through onMessage, so a large message does not have
+        // to fit in memory. Compressed messages are inflated piece by piece. The last piece of a message has isFinal set and may be empty.
+        // MaxPayload still limits the size of a message
+        virtual std::shared_ptr<IWSClient_Configuration> onMessageChunk(
+            const std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t, OpCode, bool)> &handle) = 0;
         // when a socket is closed down for ANY reason. If onconnect is called, then a matching onDisconnection is guaranteed
         virtual std::shared_ptr<IWSClient_Configuration>
         onDisconnection(const std::function<void(const std::shared_ptr<IWebSocket> &, unsigned short, const std::string &)> &handle) = 0;
@@ -230,6 +415,13 @@ namespace WS_LITE {
         // when a pong is received from a client
         virtual std::shared_ptr<IWSClient_Configuration>
         onPong(const std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t)> &handle) = 0;
+        // when the bytes waiting to be sent on a socket that went over its high watermark have fallen to its low watermark. Called on the
+        // thread of the socket, so a producer can send more here and keep pace with what the peer reads
+        virtual std::shared_ptr<IWSClient_Configuration> onDrain(const std::function<void(const std::shared_ptr<IWebSocket> &)> &handle) = 0;
+        // run onMessage and onDisconnection on a pool of threadcount worker threads instead of the io threads, so a slow handler does not
+        // hold up the other sockets of its thread. The handlers of one socket still run one at a time and in order. Each message owns its
+        // buffer, keep message.Buffer to use the data after the handler returns. The other handlers stay on the io threads
+        virtual std::shared_ptr<IWSClient_Configuration> HandlerThreads(ThreadCount threadcount) = 0;
         // connect to an endpoint. This is non-blocking and will return immediatly. If the library is unable to establish a connection,
         // ondisconnection will be called.
         virtual std::shared_ptr<IWSHub> connect(const std::string &host, PortNumber port, bool no_delay = true, const std::string &endpoint = "/",
@@ -253,6 +445,9 @@ namespace WS_LITE {
     };
 
     std::shared_ptr<ITLS_Configuration> WS_LITE_EXTERN CreateContext(ThreadCount threadcount);
+    // builds the frame for msg once. With COMPRESS a deflated copy is kept as well for sockets that negotiated permessage-deflate, it is
+    // compressed without context takeover so any of them can decode it
+    std::shared_ptr<PreparedMessage> WS_LITE_EXTERN CreatePreparedMessage(const WSMessage &msg, CompressionOptions compressmessage);
 
     /*
     THE FOLLOWING IS JUST A THIN WRAPPER AROUND ASIO context.hpp
@@ -0,0 +1,38 @@
+#pragma once
+#include "WS_Lite.h"
+#include <memory>
+
+namespace SL {
+namespace WS_LITE {
+    // message and receive buffers come from power of two size classes between 64 bytes and 1 MB. Each thread keeps a few free blocks per
+    // class (fewer of the large ones) and trades them with a shared depot in batches, so steady state sending and receiving does not
+    // call malloc. Larger blocks are mapped from the OS, and each thread keeps its last one with everything past the first MB trimmed
+    const size_t MINPOOLBLOCKSIZE = 64;
+    const size_t MAXPOOLBLOCKSIZE = 1024 * 1024;
+    WS_LITE_EXTERN void *PoolAllocate(size_t size);
+    // size has to be the size given to PoolAllocate
+    WS_LITE_EXTERN void PoolDeallocate(void *p, size_t size);
+    // moves p, allocated with oldsize, to a block of at least newsize bytes and frees p. Returns p when it is already big enough
+    WS_LITE_EXTERN void *PoolReallocate(void *p, size_t oldsize, size_t newsize);
+    // how many bytes a block allocated with size can really hold, so growing buffers can use all of it
+    WS_LITE_EXTERN size_t PoolBlockSize(size_t size);
+
+    // lets shared_ptr take its control block from the pool too
+    template <class T> class PoolAllocator {
+      public:
+        typedef T value_type;
+        PoolAllocator() = default;
+        template <class U> PoolAllocator(const PoolAllocator<U> &) {}
+        T *allocate(size_t n) { return static_cast<T *>(PoolAllocate(n * sizeof(T))); }
+        void deallocate(T *p, size_t n) { PoolDeallocate(p, n * sizeof(T)); }
+        template <class U> bool operator==(const PoolAllocator<U> &) const { return true; }
+        template <class U> bool operator!=(const PoolAllocator<U> &) const { return false; }
+    };
+
+    // a buffer of size bytes whose memory and reference count both come from the pool
+    WS_LITE_EXTERN std::shared_ptr<unsigned char> AllocateBuffer(size_t size);
+    // hands a block from PoolAllocate(size) over to a shared_ptr, which gives it back to the pool
+    WS_LITE_EXTERN std::shared_ptr<unsigned char> AdoptBuffer(unsigned char *p, size_t size);
+
+} // namespace WS_LITE
+} // namespace SL
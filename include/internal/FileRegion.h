@@ -0,0 +1,39 @@
+#pragma once
+#include "WS_Lite.h"
+#include <memory>
+#include <system_error>
+
+// the payload of a file frame can be handed to the kernel instead of being read into memory
+#if defined(__linux__)
+#define WS_LITE_HAS_SENDFILE 1
+#else
+#define WS_LITE_HAS_SENDFILE 0
+#endif
+
+namespace SL {
+namespace WS_LITE {
+
+    // an open file that is closed once the last frame referencing it has been written
+    class FileDescriptor {
+      public:
+        explicit FileDescriptor(int fd) : Fd(fd) {}
+        ~FileDescriptor();
+        FileDescriptor(const FileDescriptor &) = delete;
+        FileDescriptor &operator=(const FileDescriptor &) = delete;
+        const int Fd;
+    };
+
+    // duplicates fd so the caller can close its copy as soon as sendFile returns. Returns nullptr on failure
+    WS_LITE_EXTERN std::shared_ptr<FileDescriptor> DuplicateFile(int fd);
+    // whether fd holds length bytes, at least one, starting at offset. Mapping past the end of a file succeeds, but touching those pages
+    // raises SIGBUS
+    WS_LITE_EXTERN bool FileRegionInBounds(int fd, size_t offset, size_t length);
+    // maps length bytes of fd starting at offset, data is set to the first of them. The returned buffer keeps the mapping alive. Where
+    // mmap is not available the region is read into memory instead. Returns nullptr on failure
+    WS_LITE_EXTERN std::shared_ptr<unsigned char> MapFileRegion(int fd, size_t offset, size_t length, unsigned char *&data);
+    // copies up to length bytes of fd starting at offset to a non blocking socket inside the kernel. Returns the number of bytes sent,
+    // ec is set to would_block when the socket buffer is full
+    WS_LITE_EXTERN size_t SendFileRegion(int socket, int fd, size_t offset, size_t length, std::error_code &ec);
+
+} // namespace WS_LITE
+} // namespace SL
@@ -14,9 +14,15 @@ namespace WS_LITE {
         HubContext(ThreadCount threadcount);
         ~HubContext();
         auto getnextContext() { return ThreadContexts[(m_nextService++ % ThreadContexts.size())]; }
+        HubStatistics get_Statistics() const;
+        void publish(const std::string &topic, const std::shared_ptr<PreparedMessage> &msg);
+        // the threads of a hub count their inflaters against one budget
+        void ShareInflateBudget();
         std::atomic<std::size_t> m_nextService{0};
         std::vector<std::shared_ptr<ThreadContext>> ThreadContexts;
         std::unique_ptr<asio::ip::tcp::acceptor> acceptor;
+        // runs the handlers when HandlerThreads was called
+        std::shared_ptr<WorkerPool> Workers;
         bool TLSEnabled = false;
     };
 
@@ -0,0 +1,82 @@
+#pragma once
+#include "BufferPool.h"
+#include <atomic>
+#include <new>
+#include <utility>
+
+namespace SL {
+namespace WS_LITE {
+    // intrusive multi producer single consumer queue (Vyukov). push is wait free and can be called from any thread, pop only from the
+    // thread that owns the queue. Nodes come from the buffer pool
+    template <class T> class MPSCQueue {
+        struct Node {
+            std::atomic<Node *> Next{nullptr};
+            T Value;
+        };
+        // producers swap themselves in at Head, the consumer follows the links from Tail
+        std::atomic<Node *> Head;
+        Node *Tail;
+        // never carries a value, it marks the end of the queue once everything has been taken
+        Node Stub;
+
+        Node *stub() { return &Stub; }
+        const Node *stub() const { return &Stub; }
+        void pushnode(Node *node)
+        {
+            node->Next.store(nullptr, std::memory_order_relaxed);
+            auto prev = Head.exchange(node, std::memory_order_acq_rel);
+            prev->Next.store(node, std::memory_order_release);
+        }
+
+      public:
+        MPSCQueue() : Head(&Stub), Tail(&Stub) {}
+        ~MPSCQueue()
+        {
+            T value;
+            while (pop(value)) {
+            }
+        }
+        MPSCQueue(const MPSCQueue &) = delete;
+        MPSCQueue &operator=(const MPSCQueue &) = delete;
+
+        void push(T value)
+        {
+            auto node = new (PoolAllocate(sizeof(Node))) Node();
+            node->Value = std::move(value);
+            pushnode(node);
+        }
+        // false when the queue is empty, or when a producer is half way through a push. In that case empty() stays false, so the consumer
+        // has to come back later
+        bool pop(T &value)
+        {
+            auto tail = Tail;
+            auto next = tail->Next.load(std::memory_order_acquire);
+            if (tail == stub()) {
+                if (!next) {
+                    return false;
+                }
+                Tail = tail = next;
+                next = next->Next.load(std::memory_order_acquire);
+            }
+            if (!next) {
+                if (tail != Head.load(std::memory_order_acquire)) {
+                    return false;
+                }
+                // tail is the last node, put the stub behind it so it can be handed out
+                pushnode(stub());
+                next = tail->Next.load(std::memory_order_acquire);
+                if (!next) {
+                    return false;
+                }
+            }
+            Tail = next;
+            value = std::move(tail->Value);
+            tail->~Node();
+            PoolDeallocate(tail, sizeof(Node));
+            return true;
+        }
+        // only call this from the consumer. A push that is still in progress counts as not empty
+        bool empty() const { return Tail == stub() && Head.load(std::memory_order_acquire) == stub(); }
+    };
+} // namespace WS_LITE
+} // namespace SL
@@ -0,0 +1,23 @@
+#pragma once
+#include "WS_Lite.h"
+
+namespace SL {
+namespace WS_LITE {
+
+    class PreparedMessage {
+      public:
+        // the payload as given and its complete server frame header
+        WSMessage Message = {};
+        unsigned char Header[14] = {};
+        size_t HeaderSize = 0;
+        // the deflated payload and its header with rsv1 set. Compressed.Buffer is empty when compression was not asked for or did not make
+        // the message smaller
+        WSMessage Compressed = {};
+        unsigned char CompressedHeader[14] = {};
+        size_t CompressedHeaderSize = 0;
+        // the window Compressed was deflated with. Sockets that agreed to a smaller one get Message instead
+        int CompressedWindowBits = 15;
+    };
+
+} // namespace WS_LITE
+} // namespace SL
@@ -0,0 +1,47 @@
+#pragma once
+#include <algorithm>
+#include <openssl/rand.h>
+#include <random>
+#include <string.h>
+
+namespace SL {
+namespace WS_LITE {
+    // Random bytes for mask keys and handshake nonces. Each io thread owns one pool which is refilled 4 KB at a time from the openssl
+    // CSPRNG, so drawing a mask key is a memcpy instead of a syscall. Not thread safe, only use it from the owning io thread
+    class RandomPool {
+        static const size_t POOLSIZE = 4096;
+        unsigned char Pool[POOLSIZE];
+        size_t Position = POOLSIZE;
+
+        void refill()
+        {
+            if (RAND_bytes(Pool, static_cast<int>(POOLSIZE)) != 1) {
+                // openssl could not seed itself, fall back to the os generator
+                std::random_device rd;
+                std::uniform_int_distribution<unsigned int> dist(0, 255);
+                for (auto &c : Pool) {
+                    c = static_cast<unsigned char>(dist(rd));
+                }
+            }
+            Position = 0;
+        }
+
+      public:
+        void get(unsigned char *dst, size_t len)
+        {
+            while (len > 0) {
+                if (Position == POOLSIZE) {
+                    refill();
+                }
+                auto n = std::min(len, POOLSIZE - Position);
+                memcpy(dst, Pool + Position, n);
+                // never hand out the same bytes twice
+                memset(Pool + Position, 0, n);
+                Position += n;
+                dst += n;
+                len -= n;
+            }
+        }
+    };
+} // namespace WS_LITE
+} // namespace SL
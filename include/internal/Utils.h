@@ -81,15 +81,14 @@ namespace WS_LITE {
         }
     }
 
-    inline size_t AdditionalBodyBytesToRead(bool isServer)
+    // bytes of the header that follow the first two: the extended payload length and the mask key
+    inline size_t getExtendedHeaderLength(unsigned char *frame)
     {
-        if (isServer) {
-            return 4;
-        }
-        else {
-            return 0;
-        }
+        auto len = getpayloadLength1(frame);
+        return (len == 126 ? 2 : len == 127 ? 8 : 0) + (getMask(frame) ? 4 : 0);
     }
+    // the mask key is the last 4 bytes of the header
+    inline unsigned char *getMaskKey(unsigned char *frame) { return frame + 2 + getExtendedHeaderLength(frame) - 4; }
     inline void set_MaskBitForSending(unsigned char *frame, bool isServer)
     {
         if (isServer) {
@@ -242,24 +241,18 @@ namespace WS_LITE {
 
         return std::make_tuple(str, true);
     }
-    template <typename T> auto CreateExtensionOffer(T &header)
-    {
-        auto header_it =
-            std::find_if(std::begin(header.Values), std::end(header.Values), [](HeaderKeyValue k) { return k.Key == "Sec-WebSocket-Extensions"; });
-        if (header_it != header.Values.end()) {
-            if (auto founddeflate = header_it->Value.find("permessage-deflate"); founddeflate != header_it->Value.npos) {
-                if (auto foundclienttakeover = header_it->Value.find("client_no_context_takeover", founddeflate);
-                    foundclienttakeover != header_it->Value.npos) {
-                    return std::make_tuple(std::string("Sec-WebSocket-Extensions:permessage-deflate; client_no_context_takeover\r\n"),
-                                           ExtensionOptions::DEFLATE);
-                }
-                else {
-                    return std::make_tuple(std::string("Sec-WebSocket-Extensions:permessage-deflate\r\n"), ExtensionOptions::DEFLATE);
-                }
-            }
-        }
-        return std::make_tuple(std::string(), ExtensionOptions::NO_OPTIONS);
-    }
     bool isValidUtf8(unsigned char *s, size_t length);
+    // validates text that arrives in pieces. A sequence cut off by the end of one piece is kept until the next one completes it
+    class WS_LITE_EXTERN Utf8Validator {
+        unsigned char Carry[4] = {};
+        size_t CarrySize = 0;
+
+      public:
+        bool validate(const unsigned char *s, size_t length, bool last);
+        void reset() { CarrySize = 0; }
+    };
+    // XORs length bytes of src with the 4 byte websocket mask into dst. src and dst may be the same buffer. maskoffset is the position of
+    // src[0] within the frame payload so a payload can be masked in several pieces. Uses AVX2 or SSE2 when the cpu supports it
+    WS_LITE_EXTERN void ApplyMask(unsigned char *dst, const unsigned char *src, size_t length, const unsigned char *mask, size_t maskoffset = 0);
 } // namespace WS_LITE
 } // namespace SL
\ No newline at end of file
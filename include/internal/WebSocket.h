@@ -1,5 +1,6 @@
 #pragma once
 #include "Logging.h"
+#include "MPSCQueue.h"
 #include "SocketIOStatus.h"
 #include "WS_Lite.h"
 #include "WebSocketProtocol.h"
@@ -8,16 +9,15 @@
 #endif
 #include "asio.hpp"
 #include "asio/ssl.hpp"
+#include <array>
+#include <atomic>
 #include <deque>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace SL {
 namespace WS_LITE {
-    struct SendQueueItem {
-        WSMessage msg;
-        CompressionOptions compressmessage;
-    };
     class WebSocketContext;
     template <bool isServer, class SOCKETTYPE> class WebSocket final : public IWebSocket {
 
@@ -34,9 +34,7 @@ namespace WS_LITE {
         {
             SocketStatus_ = SocketStatus::CLOSED;
             canceltimers();
-            if (ReceiveBuffer) {
-                free(ReceiveBuffer);
-            }
+            ReleaseReceiveBuffer();
         }
         virtual SocketStatus is_open() const override { return SocketStatus_; }
         virtual std::string get_address() const override
@@ -76,7 +74,7 @@ namespace WS_LITE {
             else
                 return true;
         }
-        virtual size_t BufferedBytes() const override { return Bytes_PendingFlush; }
+        virtual size_t BufferedBytes() const override { return Bytes_PendingFlush.load(std::memory_order_relaxed); }
         virtual bool is_loopback() const override
         {
             std::error_code ec;
@@ -86,12 +84,86 @@ namespace WS_LITE {
             else
                 return true;
         }
-        virtual void send(const WSMessage &msg, CompressionOptions compressmessage) override
+        virtual SendStatus send(const WSMessage &msg, CompressionOptions compressmessage, SendPriority priority) override
+        {
+            if (SocketStatus_ == SocketStatus::CONNECTED) { // only send to a conected socket
+                auto self(std::static_pointer_cast<WebSocket<isServer, SOCKETTYPE>>(shared_from_this()));
+                return sendImpl<isServer>(self, msg, compressmessage, priority);
+            }
+            return SendStatus::NOT_CONNECTED;
+        }
+        virtual SendStatus send(std::string_view data, OpCode code, CompressionOptions compressmessage, SendPriority priority) override
+        {
+            return send(reinterpret_cast<const unsigned char *>(data.data()), data.size(), code, compressmessage, priority);
+        }
+        virtual SendStatus send(const unsigned char *data, size_t len, OpCode code, CompressionOptions compressmessage,
+                                SendPriority priority) override
         {
             if (SocketStatus_ == SocketStatus::CONNECTED) { // only send to a conected socket
+                WSMessage msg;
+                msg.Buffer = AllocateBuffer(len);
+                msg.data = msg.Buffer.get();
+                msg.len = len;
+                msg.code = code;
+                memcpy(msg.data, data, len);
                 auto self(std::static_pointer_cast<WebSocket<isServer, SOCKETTYPE>>(shared_from_this()));
-                sendImpl<isServer>(self, msg, compressmessage);
+                return sendImpl<isServer>(self, msg, compressmessage, priority);
+            }
+            return SendStatus::NOT_CONNECTED;
+        }
+        virtual SendStatus send(const std::shared_ptr<PreparedMessage> &msg, SendPriority priority) override
+        {
+            if (SocketStatus_ == SocketStatus::CONNECTED) { // only send to a conected socket
+                auto self(std::static_pointer_cast<WebSocket<isServer, SOCKETTYPE>>(shared_from_this()));
+                return sendPreparedImpl<isServer>(self, msg, priority);
+            }
+            return SendStatus::NOT_CONNECTED;
+        }
+        virtual SendStatus sendFile(int fd, size_t offset, size_t length, OpCode code, SendPriority priority) override
+        {
+            if (SocketStatus_ != SocketStatus::CONNECTED) { // only send to a conected socket
+                return SendStatus::NOT_CONNECTED;
+            }
+            if (!FileRegionInBounds(fd, offset, length)) {
+                return SendStatus::INVALID_FILE_REGION;
+            }
+            auto self(std::static_pointer_cast<WebSocket<isServer, SOCKETTYPE>>(shared_from_this()));
+#if WS_LITE_HAS_SENDFILE
+            // server frames over plain tcp are not masked or encrypted, so the kernel can copy the file to the socket
+            if (isServer && !is_tls_socket<SOCKETTYPE>::value) {
+                auto file = DuplicateFile(fd);
+                if (!file) {
+                    return SendStatus::INVALID_FILE_REGION;
+                }
+                return sendFileImpl<isServer>(self, file, offset, length, code, priority);
             }
+#endif
+            WSMessage msg;
+            msg.Buffer = MapFileRegion(fd, offset, length, msg.data);
+            if (!msg.Buffer) {
+                return SendStatus::INVALID_FILE_REGION;
+            }
+            msg.len = length;
+            msg.code = code;
+            return sendImpl<isServer>(self, msg, CompressionOptions::NO_COMPRESSION, priority);
+        }
+        virtual size_t QueuedMessages(SendPriority priority) const override
+        {
+            return Messages_Queued[static_cast<size_t>(priority)].load(std::memory_order_relaxed);
+        }
+        virtual size_t QueuedBytes(SendPriority priority) const override
+        {
+            return Bytes_Queued[static_cast<size_t>(priority)].load(std::memory_order_relaxed);
+        }
+        virtual void set_MaxQueuedBytes(size_t bytes) override { MaxQueuedBytes = bytes; }
+        virtual size_t get_MaxQueuedBytes() const override { return MaxQueuedBytes; }
+        virtual void set_MaxQueuedMessages(size_t count) override { MaxQueuedMessages = count; }
+        virtual size_t get_MaxQueuedMessages() const override { return MaxQueuedMessages; }
+        virtual void set_Watermarks(size_t high, size_t low) override
+        {
+            HighWatermark = high;
+            LowWatermark = low;
+            OwnWatermarks = true;
         }
         // send a close message and close the socket
         virtual void close(unsigned short code, const std::string &msg) override
@@ -101,6 +173,30 @@ namespace WS_LITE {
                 sendclosemessage<isServer>(self, code, msg);
             }
         }
+        // grows the reassembly buffer geometrically, so a message of many fragments is not copied again for every fragment
+        bool ReserveReceiveBuffer(size_t size)
+        {
+            if (size <= ReceiveBufferCapacity) {
+                return true;
+            }
+            auto capacity = PoolBlockSize(std::max(size, std::min(ReceiveBufferCapacity * 2, Parent->MaxPayload)));
+            try {
+                ReceiveBuffer = static_cast<unsigned char *>(PoolReallocate(ReceiveBuffer, ReceiveBufferCapacity, capacity));
+            }
+            catch (const std::bad_alloc &) {
+                return false;
+            }
+            ReceiveBufferCapacity = capacity;
+            return true;
+        }
+        void ReleaseReceiveBuffer()
+        {
+            if (ReceiveBuffer) {
+                PoolDeallocate(ReceiveBuffer, ReceiveBufferCapacity);
+                ReceiveBuffer = nullptr;
+                ReceiveBufferCapacity = 0;
+            }
+        }
         void canceltimers()
         {
             std::error_code ec;
@@ -110,23 +206,259 @@ namespace WS_LITE {
             ec.clear();
             ping_deadline.cancel(ec);
         }
-        void AddMsg(const WSMessage &msg, CompressionOptions compressmessage) { SendMessageQueue.emplace_back(SendQueueItem{msg, compressmessage}); }
+        void AddMsg(SendQueueItem item)
+        {
+            if (isControlFrame(item.msg.code)) {
+                item.priority = SendPriority::CONTROL;
+            }
+            auto level = static_cast<size_t>(item.priority);
+            Messages_Queued[level].fetch_add(1, std::memory_order_relaxed);
+            Bytes_Queued[level].fetch_add(item.msg.len, std::memory_order_relaxed);
+            SendMessageQueues[level].emplace_back(std::move(item));
+            if (level != static_cast<size_t>(SendPriority::CONTROL) && Parent->OverflowPolicy_ == OverflowPolicy::DROP_OLDEST) {
+                TrimSendQueues();
+            }
+        }
+        // the limits of this socket, or those of its hub where it has none
+        bool QueueLimitExceeded(size_t bytes, size_t messages) const
+        {
+            auto maxbytes = MaxQueuedBytes.load(std::memory_order_relaxed);
+            auto maxmessages = MaxQueuedMessages.load(std::memory_order_relaxed);
+            maxbytes = maxbytes ? maxbytes : Parent->MaxQueuedBytes;
+            maxmessages = maxmessages ? maxmessages : Parent->MaxQueuedMessages;
+            return (maxbytes && bytes > maxbytes) || (maxmessages && messages > maxmessages);
+        }
+        // remembers when the pending bytes went over the high watermark, called from any thread
+        void NotePending(size_t bytes)
+        {
+            auto high = OwnWatermarks.load(std::memory_order_relaxed) ? HighWatermark.load(std::memory_order_relaxed) : Parent->HighWatermark;
+            if (bytes > high && !AboveHighWatermark.load(std::memory_order_relaxed)) {
+                AboveHighWatermark.store(true, std::memory_order_relaxed);
+            }
+        }
+        // true once, when the pending bytes of a socket that went over the high watermark are back at the low watermark
+        bool DrainPending()
+        {
+            if (!AboveHighWatermark.load(std::memory_order_relaxed) || SocketStatus_ != SocketStatus::CONNECTED || !Parent->onDrain) {
+                return false;
+            }
+            auto low = OwnWatermarks.load(std::memory_order_relaxed) ? LowWatermark.load(std::memory_order_relaxed) : Parent->LowWatermark;
+            if (Bytes_PendingFlush.load(std::memory_order_relaxed) > low) {
+                return false;
+            }
+            AboveHighWatermark.store(false, std::memory_order_relaxed);
+            return true;
+        }
+        // undoes reserveSend for bytes that will never be written, and for the message they end when endsmessage
+        void ReleaseSend(size_t bytes, bool endsmessage)
+        {
+            Bytes_PendingFlush.fetch_sub(bytes, std::memory_order_relaxed);
+            if (endsmessage) {
+                Messages_PendingFlush.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        // drops the oldest messages that have not started going out until the socket is within its limits again, lowest priority first
+        void TrimSendQueues()
+        {
+            auto level = SENDPRIORITYCOUNT - 1;
+            while (level > static_cast<size_t>(SendPriority::CONTROL) &&
+                   QueueLimitExceeded(Bytes_PendingFlush.load(std::memory_order_relaxed), Messages_PendingFlush.load(std::memory_order_relaxed))) {
+                auto &q = SendMessageQueues[level];
+                // the rest of a message already partly written has to be sent
+                auto it = std::find_if(q.begin(), q.end(), [](const SendQueueItem &item) { return !item.continuation; });
+                if (it == q.end()) {
+                    level -= 1;
+                    continue;
+                }
+                ReleaseSend(it->msg.len, true);
+                Messages_Queued[level].fetch_sub(1, std::memory_order_relaxed);
+                Bytes_Queued[level].fetch_sub(it->msg.len, std::memory_order_relaxed);
+                q.erase(it);
+                Parent->MessagesDropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        // turns on permessage-deflate with what the handshake agreed to
+        void UseDeflate(const DeflateParameters &agreed)
+        {
+            ExtensionOption = ExtensionOptions::DEFLATE;
+            DeflateNoContextTakeover = isServer ? agreed.ServerNoContextTakeover : agreed.ClientNoContextTakeover;
+            DeflateWindowBits = isServer ? agreed.ServerMaxWindowBits : agreed.ClientMaxWindowBits;
+            InflateNoContextTakeover = isServer ? agreed.ClientNoContextTakeover : agreed.ServerNoContextTakeover;
+            InflateWindowBits = isServer ? agreed.ClientMaxWindowBits : agreed.ServerMaxWindowBits;
+            // zlib deflates with 9 bits when asked for 8, so the window has to be that large anyway
+            Inflater.WindowBits = std::max(InflateWindowBits, 9);
+            Inflater.Budget = Parent->InflateBudget_;
+        }
+        // deflates a message that is about to start going out. This happens in the order messages go on the wire, so the window of the
+        // peer matches ours whatever the priorities did to the order they were sent in
+        void DeflateMessage(SendQueueItem &item)
+        {
+            if (item.prepared) {
+                // compressed once for every socket, without our window. The peer's window now holds data ours does not
+                Deflater.reset();
+                return;
+            }
+            // zlib cannot deflate with a window of 8 bits
+            if (DeflateWindowBits < 9) {
+                return;
+            }
+            // small messages would only grow, and a socket that recently sent data that did not compress waits a while before trying
+            // again. Sending a message as is leaves the window alone, with or without context takeover
+            if (item.msg.len < Parent->CompressionThreshold) {
+                Parent->CompressionsSkipped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            if (CompressionBackoff > 0) {
+                CompressionBackoff -= 1;
+                Parent->CompressionsSkipped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            auto start = std::chrono::steady_clock::now();
+            auto compressionlevel = Parent->CompressionLevelNow(start);
+            if (compressionlevel == Z_NO_COMPRESSION) {
+                Parent->CompressionsSkipped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            auto deflated = Deflater.deflate(item.msg, compressionlevel, Parent->CompressionMemLevel, DeflateWindowBits, DeflateNoContextTakeover);
+            auto out = deflated.Buffer ? deflated.len : item.msg.len;
+            Parent->CompressionDone(item.msg.len, out, std::chrono::steady_clock::now() - start);
+            SampledBytesIn += item.msg.len;
+            SampledBytesOut += out;
+            if (SampledBytesIn >= COMPRESSIONSAMPLESIZE) {
+                if (SampledBytesOut * 100 > SampledBytesIn * MAXCOMPRESSIONRATIO) {
+                    CompressionBackoff = COMPRESSIONBACKOFF;
+                }
+                SampledBytesIn = SampledBytesOut = 0;
+            }
+            if (!deflated.Buffer) {
+                return;
+            }
+            // the queues counted the message at its original size
+            auto level = static_cast<size_t>(item.priority);
+            Bytes_PendingFlush.fetch_add(deflated.len, std::memory_order_relaxed);
+            Bytes_PendingFlush.fetch_sub(item.msg.len, std::memory_order_relaxed);
+            Bytes_Queued[level].fetch_add(deflated.len, std::memory_order_relaxed);
+            Bytes_Queued[level].fetch_sub(item.msg.len, std::memory_order_relaxed);
+            item.msg = deflated;
+            item.compressed = true;
+        }
+        // called once a frame has been written
+        void FrameSent(const SendQueueItem &item)
+        {
+            if (item.msg.data == PongBuffer) {
+                PongPending = false;
+            }
+            ReleaseSend(item.msg.len, item.fin);
+            auto level = static_cast<size_t>(item.priority);
+            Bytes_Queued[level].fetch_sub(item.msg.len, std::memory_order_relaxed);
+            if (item.fin) {
+                Messages_Queued[level].fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        bool SendQueueEmpty() const
+        {
+            return std::all_of(SendMessageQueues.begin(), SendMessageQueues.end(), [](const auto &q) { return q.empty(); });
+        }
+        void ClearSendQueues()
+        {
+            for (auto &q : SendMessageQueues) {
+                for (auto &item : q) {
+                    ReleaseSend(item.msg.len, item.fin);
+                    PongPending = PongPending && item.msg.data != PongBuffer;
+                }
+                q.clear();
+            }
+            // frames of a write still in flight are accounted for when it completes
+            for (size_t i = 0; i < SENDPRIORITYCOUNT; i++) {
+                Messages_Queued[i] = 0;
+                Bytes_Queued[i] = 0;
+            }
+            for (auto &item : SendBatch) {
+                Messages_Queued[static_cast<size_t>(item.priority)] += item.fin ? 1 : 0;
+                Bytes_Queued[static_cast<size_t>(item.priority)] += item.msg.len;
+            }
+        }
+        // reassembles the fragments of a message. It is kept from one message to the next
         unsigned char *ReceiveBuffer = nullptr;
         size_t ReceiveBufferSize = 0;
-        unsigned char ReceiveHeader[14] = {};
+        size_t ReceiveBufferCapacity = 0;
+        // the header of the frame being read, including its mask key
+        unsigned char ReceiveHeader[MAXHEADERSIZE] = {};
+        // state of the message being streamed to onMessageChunk: payload bytes left in the current frame, where the next piece starts
+        // within the frame for unmasking, and the bytes received and handed over so far
+        size_t StreamRemaining = 0;
+        size_t StreamMaskOffset = 0;
+        size_t StreamReceived = 0;
+        size_t StreamDelivered = 0;
+        Utf8Validator StreamUtf8;
+        // see SocketInflater
+        SocketInflater Inflater;
+        // set by evictInflater, compressed messages are dropped from then on
+        bool InflaterEvicted = false;
+        // payload of the control frame being read, and of the pong answering the last ping while PongPending is set
+        unsigned char ControlBuffer[CONTROLBUFFERMAXSIZE] = {};
+        unsigned char PongBuffer[CONTROLBUFFERMAXSIZE] = {};
+        bool PongPending = false;
+        // events for the worker pool when HandlerThreads is set, see runHandlers
+        MPSCQueue<HandlerEvent> Handlers;
+        std::atomic<size_t> HandlersPending{0};
+        // depth of handlers called straight from ReadInto
+        size_t InlineReads = 0;
+        // frames of the write in flight, their headers (including the 4 byte mask for clients) and the buffer sequence handed to asio
+        std::vector<SendQueueItem> SendBatch;
+        std::vector<std::array<unsigned char, MAXHEADERSIZE>> SendHeaders;
+        std::vector<size_t> SendHeaderSizes;
+        std::vector<asio::const_buffer> SendBuffers;
+        std::vector<unsigned char> SendCoalesceBuffer;
+        std::vector<unsigned char> SendMaskBuffer;
         ExtensionOptions ExtensionOption = ExtensionOptions::NO_OPTIONS;
+        // outbound permessage-deflate, only used when ExtensionOption is DEFLATE. Without context takeover every message is deflated
+        // with an empty window
+        MessageDeflater Deflater;
+        bool DeflateNoContextTakeover = false;
+        int DeflateWindowBits = 15;
+        // bytes deflated since the last look at the ratio, and the messages left to send as they are because it was too poor
+        size_t SampledBytesIn = 0;
+        size_t SampledBytesOut = 0;
+        size_t CompressionBackoff = 0;
+        // what the peer agreed to deflate with
+        bool InflateNoContextTakeover = false;
+        int InflateWindowBits = 15;
         SocketStatus SocketStatus_ = SocketStatus::CLOSED;
         SocketIOStatus Writing = SocketIOStatus::NOTWRITING;
         OpCode LastOpCode = OpCode::INVALID;
         bool FrameCompressed = false;
         std::shared_ptr<WebSocketContext> Parent;
         SOCKETTYPE Socket;
-        size_t Bytes_PendingFlush = 0;
+        // bytes and messages counted by reserveSend that have not been written or dropped yet
+        std::atomic<size_t> Bytes_PendingFlush{0};
+        std::atomic<size_t> Messages_PendingFlush{0};
+        // per socket queue limits, 0 uses those of the hub
+        std::atomic<size_t> MaxQueuedBytes{0};
+        std::atomic<size_t> MaxQueuedMessages{0};
+        // watermarks set by set_Watermarks, the hub ones are used until then
+        std::atomic<size_t> HighWatermark{0};
+        std::atomic<size_t> LowWatermark{0};
+        std::atomic<bool> OwnWatermarks{false};
+        std::atomic<bool> AboveHighWatermark{false};
+        // set once an overflow has started closing the socket so only one close is sent
+        std::atomic<bool> OverflowClosed{false};
+        // messages sent from any thread wait here until the io thread moves them to SendMessageQueues. OutboxScheduled is set while a
+        // drain is posted
+        MPSCQueue<SendQueueItem> Outbox;
+        std::atomic<bool> OutboxScheduled{false};
+        // topics this socket is subscribed to
+        std::vector<std::string> Topics;
+        // payload bytes of the file frame in flight already handed to the kernel
+        size_t FileBytesSent = 0;
 
         asio::basic_waitable_timer<std::chrono::steady_clock> ping_deadline;
         asio::basic_waitable_timer<std::chrono::steady_clock> read_deadline;
         asio::basic_waitable_timer<std::chrono::steady_clock> write_deadline;
-        std::deque<SendQueueItem> SendMessageQueue;
+        // one queue per SendPriority
+        std::array<std::deque<SendQueueItem>, SENDPRIORITYCOUNT> SendMessageQueues;
+        std::array<std::atomic<size_t>, SENDPRIORITYCOUNT> Messages_Queued = {};
+        std::array<std::atomic<size_t>, SENDPRIORITYCOUNT> Bytes_Queued = {};
     };
 
 } // namespace WS_LITE
@@ -1,101 +1,522 @@
 #pragma once
+#include "BufferPool.h"
+#include "Extensions.h"
 #include "Logging.h"
+#include "RandomPool.h"
 #include "WS_Lite.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <functional>
 #include <memory>
+#include <stdint.h>
 #include <string.h>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 #include <zlib.h>
 namespace SL {
 namespace WS_LITE {
-    const size_t LARGE_BUFFER_SIZE = 1024 * 1024; // 1 MB temp buffer
+    // the inflate buffer is given back after a message that made it larger than this
+    const size_t MAX_RETAINED_INFLATE_SIZE = 1024 * 1024; // 1 MB
+    // streamed messages are inflated in pieces of at most this size
+    const size_t INFLATECHUNKSIZE = 64 * 1024;
     class IWebSocket;
     struct HttpHeader;
     struct WSMessage;
+    class PreparedMessage;
+    struct TopicSubscriber {
+        // only used to find the entry again, never dereferenced
+        const IWebSocket *Key;
+        std::weak_ptr<IWebSocket> Socket;
+        void (*Send)(const std::shared_ptr<IWebSocket> &, const std::shared_ptr<PreparedMessage> &);
+    };
+    // zlib memory the inflaters of a hub's sockets hold on to, shared by its threads
+    struct InflateBudget {
+        std::atomic<size_t> Limit{0}; // 0 is unlimited
+        std::atomic<size_t> Used{0};
+        std::atomic<size_t> Evictions{0};
+        bool exceeded() const
+        {
+            auto limit = Limit.load(std::memory_order_relaxed);
+            return limit > 0 && Used.load(std::memory_order_relaxed) > limit;
+        }
+    };
+    // room in front of the blocks zlib gets from the pool for their size, enough to keep them aligned
+    const size_t ZLIBHEADERSIZE = 16;
+    // zalloc and zfree taking zlib state and windows from the buffer pool. opaque is the InflateBudget the memory counts against, if any
+    inline voidpf ZlibAllocate(voidpf opaque, uInt items, uInt size)
+    {
+        auto bytes = ZLIBHEADERSIZE + static_cast<size_t>(items) * size;
+        unsigned char *p;
+        try {
+            p = static_cast<unsigned char *>(PoolAllocate(bytes));
+        }
+        catch (const std::bad_alloc &) {
+            return Z_NULL;
+        }
+        *reinterpret_cast<size_t *>(p) = bytes;
+        if (opaque) {
+            static_cast<InflateBudget *>(opaque)->Used.fetch_add(bytes, std::memory_order_relaxed);
+        }
+        return p + ZLIBHEADERSIZE;
+    }
+    inline void ZlibFree(voidpf opaque, voidpf address)
+    {
+        auto p = static_cast<unsigned char *>(address) - ZLIBHEADERSIZE;
+        auto bytes = *reinterpret_cast<size_t *>(p);
+        if (opaque) {
+            static_cast<InflateBudget *>(opaque)->Used.fetch_sub(bytes, std::memory_order_relaxed);
+        }
+        PoolDeallocate(p, bytes);
+    }
+    // inflate state of a socket, for messages streamed to onMessageChunk and for every message when the peer deflates with context
+    // takeover. Set up by the first message that needs it, its memory counts against Budget
+    struct SocketInflater {
+        z_stream Stream = {};
+        bool Initialized = false;
+        int WindowBits = MAX_WBITS;
+        std::shared_ptr<InflateBudget> Budget;
+        SocketInflater() = default;
+        SocketInflater(const SocketInflater &) = delete;
+        SocketInflater &operator=(const SocketInflater &) = delete;
+        ~SocketInflater() { release(); }
+        z_stream &get()
+        {
+            if (!Initialized) {
+                Stream = {};
+                Stream.zalloc = ZlibAllocate;
+                Stream.zfree = ZlibFree;
+                Stream.opaque = Budget.get();
+                inflateInit2(&Stream, -WindowBits);
+                Initialized = true;
+            }
+            return Stream;
+        }
+        void reset()
+        {
+            if (Initialized) {
+                inflateReset(&Stream);
+            }
+        }
+        // frees the window, the next message starts a new one
+        void release()
+        {
+            if (Initialized) {
+                inflateEnd(&Stream);
+                Initialized = false;
+            }
+        }
+    };
+    // a socket whose inflater keeps its window between messages, see WebSocketContext::InflaterUsed
+    struct TakeoverInflater {
+        std::weak_ptr<IWebSocket> Socket;
+        void (*Evict)(const std::shared_ptr<IWebSocket> &) = nullptr;
+        std::chrono::steady_clock::time_point LastUsed;
+    };
+    // deflate state of a socket that sends compressed messages, set up by the first one
+    struct MessageDeflater {
+        z_stream Stream = {};
+        bool Initialized = false;
+        int Level = Z_DEFAULT_COMPRESSION;
+        MessageDeflater() = default;
+        MessageDeflater(const MessageDeflater &) = delete;
+        MessageDeflater &operator=(const MessageDeflater &) = delete;
+        ~MessageDeflater()
+        {
+            if (Initialized) {
+                deflateEnd(&Stream);
+            }
+        }
+        // deflates msg as one permessage-deflate message into a pooled buffer. Without context takeover the window starts empty for
+        // every message, and an empty message is returned when deflating saves nothing so msg can go out as is. With context takeover
+        // the result always has to be sent, because it is already part of the window the peer has to keep in step with. An empty
+        // message is also returned when deflating failed, the window is emptied then so msg can go out as is in either case
+        WSMessage deflate(const WSMessage &msg, int level, int memlevel, int windowbits, bool nocontexttakeover)
+        {
+            WSMessage compressed = {};
+            if (!Initialized) {
+                Stream.zalloc = ZlibAllocate;
+                Stream.zfree = ZlibFree;
+                if (deflateInit2(&Stream, level, Z_DEFLATED, -windowbits, memlevel, Z_DEFAULT_STRATEGY) != Z_OK) {
+                    return compressed;
+                }
+                Initialized = true;
+                Level = level;
+            }
+            // room for the empty block a sync flush ends with, grown if that is not enough
+            auto capacity = PoolBlockSize(deflateBound(&Stream, static_cast<uLong>(msg.len)) + 16);
+            auto buffer = static_cast<unsigned char *>(PoolAllocate(capacity));
+            Stream.next_out = buffer;
+            Stream.avail_out = static_cast<uInt>(capacity);
+            if (level != Level) {
+                // the last message ended with a flush, so the window carries over to the new level
+                deflateParams(&Stream, level, Z_DEFAULT_STRATEGY);
+                Level = level;
+            }
+            Stream.next_in = msg.data;
+            Stream.avail_in = static_cast<uInt>(msg.len);
+            size_t produced = capacity - Stream.avail_out;
+            int err;
+            do {
+                if (produced == capacity) {
+                    auto grown = PoolBlockSize(capacity * 2);
+                    try {
+                        buffer = static_cast<unsigned char *>(PoolReallocate(buffer, capacity, grown));
+                    }
+                    catch (const std::bad_alloc &) {
+                        err = Z_MEM_ERROR;
+                        break;
+                    }
+                    capacity = grown;
+                }
+                Stream.next_out = buffer + produced;
+                Stream.avail_out = static_cast<uInt>(capacity - produced);
+                err = ::deflate(&Stream, Z_SYNC_FLUSH);
+                produced = capacity - Stream.avail_out;
+            } while (err == Z_OK && Stream.avail_out == 0);
+            // when the flush filled the buffer exactly, the call after it has nothing left to write and says Z_BUF_ERROR
+            const unsigned char tail[] = {0x00, 0x00, 0xff, 0xff};
+            auto flushed = (err == Z_OK || err == Z_BUF_ERROR) && Stream.avail_in == 0 && produced >= sizeof(tail) &&
+                           memcmp(buffer + produced - sizeof(tail), tail, sizeof(tail)) == 0;
+            if (!flushed || nocontexttakeover) {
+                // after a failure the window holds input the peer never gets. Starting over with an empty one keeps the messages that
+                // follow valid, whatever the peer's window still holds
+                deflateReset(&Stream);
+            }
+            // the 00 00 ff ff that ends the flush is left off, receivers append it again
+            if (!flushed || (nocontexttakeover && produced - sizeof(tail) >= msg.len)) {
+                PoolDeallocate(buffer, capacity);
+                return compressed;
+            }
+            compressed.Buffer = AdoptBuffer(buffer, capacity);
+            compressed.data = buffer;
+            compressed.len = produced - 4;
+            compressed.code = msg.code;
+            return compressed;
+        }
+        // forgets the window, for when the peer saw data this stream did not
+        void reset()
+        {
+            if (Initialized) {
+                deflateReset(&Stream);
+            }
+        }
+    };
     class WebSocketContext {
+        // inflated output goes straight in here. Pooled, and kept between messages unless one made it larger than
+        // MAX_RETAINED_INFLATE_SIZE
         unsigned char *InflateBuffer = nullptr;
         size_t InflateBufferSize = 0;
-        std::unique_ptr<unsigned char[]> TempInflateBuffer;
+        size_t InflateBufferCapacity = 0;
         z_stream InflationStream = {};
-        auto returnemptyinflate()
+        // grows the inflate buffer to at least size bytes, keeping what is in it
+        bool reserveinflate(size_t size)
         {
-            unsigned char *p = nullptr;
-            size_t o = 0;
-            return std::make_tuple(p, o);
+            if (size <= InflateBufferCapacity) {
+                return true;
+            }
+            auto capacity = PoolBlockSize(size);
+            try {
+                InflateBuffer = static_cast<unsigned char *>(PoolReallocate(InflateBuffer, InflateBufferCapacity, capacity));
+            }
+            catch (const std::bad_alloc &) {
+                SL_WS_LITE_LOG(Logging_Levels::ERROR_log_level, "INFLATE MEMORY ALLOCATION ERROR!!! Tried to allocate " << capacity);
+                return false;
+            }
+            InflateBufferCapacity = capacity;
+            return true;
         }
 
       public:
         WebSocketContext()
         {
-            TempInflateBuffer = std::make_unique<unsigned char[]>(LARGE_BUFFER_SIZE);
+            InflationStream.zalloc = ZlibAllocate;
+            InflationStream.zfree = ZlibFree;
             inflateInit2(&InflationStream, -MAX_WBITS);
         }
         ~WebSocketContext()
         {
             inflateEnd(&InflationStream);
-            free(InflateBuffer);
+            if (InflateBuffer) {
+                PoolDeallocate(InflateBuffer, InflateBufferCapacity);
+            }
         }
         auto beginInflate()
         {
             InflateBufferSize = 0;
-            free(InflateBuffer);
-            InflateBuffer = nullptr;
+            if (InflateBuffer && InflateBufferCapacity > MAX_RETAINED_INFLATE_SIZE) {
+                PoolDeallocate(InflateBuffer, InflateBufferCapacity);
+                InflateBuffer = nullptr;
+                InflateBufferCapacity = 0;
+            }
         }
-        auto Inflate(unsigned char *data, size_t data_len)
+        // inflates a whole message, tail included, with stream into the inflate buffer. The buffer doubles whenever zlib fills it, but
+        // never past MaxPayload + 1 bytes, so a message that inflates to more than MaxPayload is stopped there. Returns the output and 0,
+        // or the close code the socket has to be failed with
+        std::tuple<unsigned char *, size_t, unsigned short> Inflate(z_stream &stream, unsigned char *data, size_t data_len)
         {
-            InflationStream.next_in = (Bytef *)data;
-            InflationStream.avail_in = data_len;
-
-            int err;
-            do {
-                InflationStream.next_out = (Bytef *)TempInflateBuffer.get();
-                InflationStream.avail_out = LARGE_BUFFER_SIZE;
-                err = ::inflate(&InflationStream, Z_FINISH);
-                if (!InflationStream.avail_in) {
+            stream.next_in = static_cast<Bytef *>(data);
+            stream.avail_in = static_cast<uInt>(data_len);
+            InflateBufferSize = 0;
+            for (;;) {
+                if (InflateBufferSize == InflateBufferCapacity) {
+                    // messages usually inflate to a few times their size
+                    auto wanted = std::max({InflateBufferCapacity * 2, data_len * 4, INFLATECHUNKSIZE});
+                    if (!reserveinflate(std::min(wanted, MaxPayload + 1))) {
+                        return std::make_tuple(nullptr, 0, 1009);
+                    }
+                }
+                stream.next_out = static_cast<Bytef *>(InflateBuffer + InflateBufferSize);
+                stream.avail_out = static_cast<uInt>(std::min<size_t>(InflateBufferCapacity - InflateBufferSize, UINT32_MAX));
+                auto before = stream.avail_out;
+                auto err = ::inflate(&stream, Z_SYNC_FLUSH);
+                InflateBufferSize += before - stream.avail_out;
+                if (InflateBufferSize > MaxPayload) {
+                    return std::make_tuple(nullptr, 0, 1009);
+                }
+                if (err == Z_STREAM_END) {
+                    // a final block ends the window too
+                    inflateReset(&stream);
                     break;
                 }
-                auto growsize = LARGE_BUFFER_SIZE - InflationStream.avail_out;
-                InflateBufferSize += growsize;
-                auto beforesize = InflateBufferSize;
-                InflateBuffer = static_cast<unsigned char *>(realloc(InflateBuffer, InflateBufferSize));
-                if (!InflateBuffer) {
-                    SL_WS_LITE_LOG(Logging_Levels::ERROR_log_level, "INFLATE MEMORY ALLOCATION ERROR!!! Tried to realloc " << InflateBufferSize);
-                    return returnemptyinflate();
+                if (err != Z_OK && err != Z_BUF_ERROR) {
+                    return std::make_tuple(nullptr, 0, 1007);
                 }
-                memcpy(InflateBuffer + beforesize, TempInflateBuffer.get(), growsize);
-            } while (err == Z_BUF_ERROR && InflateBufferSize <= MaxPayload);
-
-            inflateReset(&InflationStream);
-
-            if ((err != Z_BUF_ERROR && err != Z_OK) || InflateBufferSize > MaxPayload) {
-                return returnemptyinflate();
-            }
-            if (InflateBufferSize > 0) {
-                auto growsize = LARGE_BUFFER_SIZE - InflationStream.avail_out;
-                InflateBufferSize += growsize;
-                auto beforesize = InflateBufferSize;
-                InflateBuffer = static_cast<unsigned char *>(realloc(InflateBuffer, InflateBufferSize));
-                if (!InflateBuffer) {
-                    SL_WS_LITE_LOG(Logging_Levels::ERROR_log_level, "INFLATE MEMORY ALLOCATION ERROR!!! Tried to realloc " << InflateBufferSize);
-                    return returnemptyinflate();
+                if (stream.avail_out != 0) {
+                    break;
                 }
-                memcpy(InflateBuffer + beforesize, TempInflateBuffer.get(), growsize);
-                return std::make_tuple(InflateBuffer, InflateBufferSize);
             }
-            return std::make_tuple(TempInflateBuffer.get(), LARGE_BUFFER_SIZE - (size_t)InflationStream.avail_out);
+            return std::make_tuple(InflateBuffer, InflateBufferSize, 0);
+        }
+        // inflates a message that starts with an empty window
+        auto Inflate(unsigned char *data, size_t data_len)
+        {
+            auto inflated = Inflate(InflationStream, data, data_len);
+            inflateReset(&InflationStream);
+            return inflated;
         }
         auto endInflate() { beginInflate(); }
+        // gives up the inflate buffer if data is in it, so a message can outlive the call that inflated it
+        std::shared_ptr<unsigned char> TakeInflated(const unsigned char *data)
+        {
+            if (!InflateBuffer || data != InflateBuffer) {
+                return std::shared_ptr<unsigned char>();
+            }
+            auto buffer = AdoptBuffer(InflateBuffer, InflateBufferCapacity);
+            InflateBuffer = nullptr;
+            InflateBufferSize = 0;
+            InflateBufferCapacity = 0;
+            return buffer;
+        }
+        // inflates one piece of a streamed message with the stream of its socket, handing the output to deliver in pieces of at most
+        // INFLATECHUNKSIZE. The last call to deliver for the piece that ends the message has its final flag set, even if it carries no
+        // data. Returns false if the data is corrupt or deliver returned false
+        template <class DELIVER> bool InflateChunk(z_stream &stream, unsigned char *data, size_t len, bool last, DELIVER &&deliver)
+        {
+            if (!reserveinflate(INFLATECHUNKSIZE)) {
+                return false;
+            }
+            stream.next_in = static_cast<Bytef *>(data);
+            stream.avail_in = static_cast<uInt>(len);
+            auto more = true;
+            while (more) {
+                stream.next_out = static_cast<Bytef *>(InflateBuffer);
+                stream.avail_out = static_cast<uInt>(INFLATECHUNKSIZE);
+                auto err = ::inflate(&stream, Z_SYNC_FLUSH);
+                if (err != Z_OK && err != Z_BUF_ERROR && err != Z_STREAM_END) {
+                    return false;
+                }
+                if (err == Z_STREAM_END) {
+                    inflateReset(&stream);
+                }
+                more = stream.avail_out == 0;
+                auto produced = INFLATECHUNKSIZE - stream.avail_out;
+                if ((produced > 0 || (last && !more)) && !deliver(InflateBuffer, produced, last && !more)) {
+                    return false;
+                }
+            }
+            return true;
+        }
         std::function<void(const std::shared_ptr<IWebSocket> &, const HttpHeader &)> onConnection;
         std::function<void(const std::shared_ptr<IWebSocket> &, const WSMessage &)> onMessage;
         std::function<void(const std::shared_ptr<IWebSocket> &, unsigned short, const std::string &)> onDisconnection;
         std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t)> onPing;
         std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t)> onPong;
+        std::function<void(const std::shared_ptr<IWebSocket> &)> onDrain;
+        std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t, OpCode, bool)> onMessageChunk;
+        // set by HandlerThreads, onMessage and onDisconnection then run here instead of on the io thread
+        std::shared_ptr<WorkerPool> Workers;
 
         std::chrono::seconds WriteTimeout = std::chrono::seconds(30);
         std::chrono::seconds ReadTimeout = std::chrono::seconds(30);
         size_t MaxPayload = 1024 * 1024 * 20; // 20 MB
+        size_t MaxFlushBytes = 1024 * 256;    // 256 KB
+        size_t MaxFlushBuffers = 64;
+        size_t MaxFrameSize = 0; // 0 sends every message as a single frame
+
+        // written by the io thread only, read from any thread
+        std::atomic<size_t> Flushes{0};
+        std::atomic<size_t> FramesFlushed{0};
+        std::atomic<size_t> Reads{0};
+        std::atomic<size_t> FramesReceived{0};
 
         ExtensionOptions ExtensionOptions_ = ExtensionOptions::NO_OPTIONS;
+        RandomPool Random;
+
+        // subscribers of each topic among the sockets of this thread. Only touched on the io thread
+        std::unordered_map<std::string, std::vector<TopicSubscriber>> Topics;
+        size_t MaxPublishBacklog = 0; // 0 never skips a subscriber
+        std::atomic<size_t> PublishDelivered{0};
+        std::atomic<size_t> PublishSkipped{0};
+
+        // outbound queue limits of each socket, 0 is unlimited
+        size_t MaxQueuedBytes = 0;
+        size_t MaxQueuedMessages = 0;
+        OverflowPolicy OverflowPolicy_ = OverflowPolicy::REJECT;
+        size_t HighWatermark = 1024 * 1024; // 1 MB
+        size_t LowWatermark = 1024 * 256;   // 256 KB
+        // written by whichever thread called send
+        std::atomic<size_t> SendsRejected{0};
+        std::atomic<size_t> MessagesDropped{0};
+        std::atomic<size_t> OverflowCloses{0};
+        // deflate settings for the sockets of this thread
+        int CompressionLevel = Z_DEFAULT_COMPRESSION;
+        int CompressionMemLevel = 8;
+        // messages smaller than this are sent as they are
+        size_t CompressionThreshold = 64;
+        // deflate time this thread may spend per second, 0 is unlimited. See CompressionLevelNow
+        std::chrono::microseconds CompressionCpuBudget{0};
+        // deflate time spent since CompressionPeriodStart, only touched on the io thread
+        std::chrono::steady_clock::time_point CompressionPeriodStart;
+        std::chrono::steady_clock::duration CompressionPeriodTime{0};
+        // written by the io thread only, read from any thread
+        std::atomic<size_t> MessagesCompressed{0};
+        std::atomic<size_t> CompressionsSkipped{0};
+        std::atomic<size_t> CompressionBytesIn{0};
+        std::atomic<size_t> CompressionBytesOut{0};
+        std::atomic<size_t> CompressionMicroseconds{0};
+        // what permessage-deflate is negotiated with
+        DeflateSettings DeflateSettings_;
+        // shared with the other threads of the hub
+        std::shared_ptr<InflateBudget> InflateBudget_ = std::make_shared<InflateBudget>();
+        // sockets of this thread whose inflater keeps its window. Only touched on the io thread
+        std::unordered_map<const IWebSocket *, TakeoverInflater> TakeoverInflaters;
+
+        // the level to deflate the next message with. Past the CPU budget of the current second messages are deflated as fast as zlib
+        // can, past twice the budget Z_NO_COMPRESSION is returned and they are sent as they are
+        int CompressionLevelNow(std::chrono::steady_clock::time_point now)
+        {
+            if (CompressionCpuBudget.count() == 0) {
+                return CompressionLevel;
+            }
+            if (now - CompressionPeriodStart >= std::chrono::seconds(1)) {
+                CompressionPeriodStart = now;
+                CompressionPeriodTime = std::chrono::steady_clock::duration(0);
+            }
+            if (CompressionPeriodTime >= 2 * CompressionCpuBudget) {
+                return Z_NO_COMPRESSION;
+            }
+            if (CompressionPeriodTime >= CompressionCpuBudget && CompressionLevel != Z_NO_COMPRESSION) {
+                return Z_BEST_SPEED;
+            }
+            return CompressionLevel;
+        }
+        void CompressionDone(size_t in, size_t out, std::chrono::steady_clock::duration spent)
+        {
+            CompressionPeriodTime += spent;
+            MessagesCompressed.fetch_add(1, std::memory_order_relaxed);
+            CompressionBytesIn.fetch_add(in, std::memory_order_relaxed);
+            CompressionBytesOut.fetch_add(out, std::memory_order_relaxed);
+            CompressionMicroseconds.fetch_add(static_cast<size_t>(std::chrono::duration_cast<std::chrono::microseconds>(spent).count()),
+                                              std::memory_order_relaxed);
+        }
+        // what to offer or accept. Peers are no longer allowed to keep their window while the inflate budget is exceeded
+        DeflateSettings OfferedDeflateSettings() const
+        {
+            auto settings = DeflateSettings_;
+            settings.DecompressionNoContextTakeover = settings.DecompressionNoContextTakeover || InflateBudget_->exceeded();
+            return settings;
+        }
+        // called after socket inflated a message with its own window. Sockets of this thread that have not done so for the longest are
+        // evicted until the budget is met again
+        void InflaterUsed(const std::shared_ptr<IWebSocket> &socket, void (*evict)(const std::shared_ptr<IWebSocket> &))
+        {
+            auto &entry = TakeoverInflaters[socket.get()];
+            if (entry.Socket.expired()) {
+                entry.Socket = socket;
+                entry.Evict = evict;
+            }
+            entry.LastUsed = std::chrono::steady_clock::now();
+            while (InflateBudget_->exceeded()) {
+                auto oldest = TakeoverInflaters.end();
+                for (auto it = TakeoverInflaters.begin(); it != TakeoverInflaters.end();) {
+                    if (it->second.Socket.expired()) {
+                        it = TakeoverInflaters.erase(it);
+                        continue;
+                    }
+                    if (it->first != socket.get() && (oldest == TakeoverInflaters.end() || it->second.LastUsed < oldest->second.LastUsed)) {
+                        oldest = it;
+                    }
+                    ++it;
+                }
+                if (oldest == TakeoverInflaters.end()) {
+                    return;
+                }
+                auto victim = oldest->second.Socket.lock();
+                auto victimevict = oldest->second.Evict;
+                TakeoverInflaters.erase(oldest);
+                if (victim) {
+                    victimevict(victim);
+                    InflateBudget_->Evictions.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        void Subscribe(const std::string &topic, const std::shared_ptr<IWebSocket> &socket,
+                       void (*send)(const std::shared_ptr<IWebSocket> &, const std::shared_ptr<PreparedMessage> &))
+        {
+            Topics[topic].push_back(TopicSubscriber{socket.get(), socket, send});
+        }
+        void Unsubscribe(const std::string &topic, const IWebSocket *socket)
+        {
+            auto t = Topics.find(topic);
+            if (t == Topics.end()) {
+                return;
+            }
+            auto &subscribers = t->second;
+            auto it = std::find_if(subscribers.begin(), subscribers.end(), [socket](const TopicSubscriber &s) { return s.Key == socket; });
+            if (it != subscribers.end()) {
+                // order does not matter, so swap with the last instead of shifting the rest down
+                *it = std::move(subscribers.back());
+                subscribers.pop_back();
+            }
+            if (subscribers.empty()) {
+                Topics.erase(t);
+            }
+        }
+        void Publish(const std::string &topic, const std::shared_ptr<PreparedMessage> &msg)
+        {
+            auto t = Topics.find(topic);
+            if (t == Topics.end()) {
+                return;
+            }
+            size_t delivered = 0, skipped = 0;
+            for (auto &subscriber : t->second) {
+                if (auto socket = subscriber.Socket.lock()) {
+                    if (MaxPublishBacklog > 0 && socket->BufferedBytes() > MaxPublishBacklog) {
+                        skipped += 1;
+                    }
+                    else {
+                        subscriber.Send(socket, msg);
+                        delivered += 1;
+                    }
+                }
+            }
+            PublishDelivered.fetch_add(delivered, std::memory_order_relaxed);
+            PublishSkipped.fetch_add(skipped, std::memory_order_relaxed);
+        }
     };
 } // namespace WS_LITE
 } // namespace SL
\ No newline at end of file
@@ -1,20 +1,76 @@
 #pragma once
+#include "BufferPool.h"
+#include "FileRegion.h"
+#include "PreparedMessage.h"
+#include "RandomPool.h"
 #include "SocketIOStatus.h"
 #include "Utils.h"
+#include "asio/ssl/stream.hpp"
 #include "asio/streambuf.hpp"
+#include <array>
 #include <deque>
 #include <memory>
-#include <random>
 #include <string>
 namespace SL {
 namespace WS_LITE {
+    // largest frame that is copied into one contiguous buffer before being written to an ssl stream
+    const size_t TLS_COALESCE_SIZE = 16 * 1024;
+    // staging buffers larger than this are released once the write that needed them completes, and reassembly buffers once their
+    // message has been handled
+    const size_t MAX_RETAINED_STAGING_SIZE = 1024 * 1024;
+    // 2 byte header + 8 byte extended length + 4 byte mask
+    const size_t MAXHEADERSIZE = 14;
+    const size_t SENDPRIORITYCOUNT = static_cast<size_t>(SendPriority::BULK) + 1;
+    // reads of fewer missing bytes than this pull whatever the socket has into extradata, so one read can carry many frames. Longer
+    // ones go straight into their destination
+    const size_t READAHEADTHRESHOLD = 64 * 1024;
+    // streamed messages are read and handed to onMessageChunk in pieces of at most this size
+    const size_t STREAMCHUNKSIZE = 64 * 1024;
+    // reads served from extradata call their handler right away, at most this many in a row, so the stack stays bounded
+    const size_t MAXINLINEREADS = 64;
+    // events a worker handles for one socket before it lets other sockets have a turn
+    const size_t MAXHANDLERBATCH = 32;
+    // a socket looks at how well its messages compress every COMPRESSIONSAMPLESIZE bytes. When they came out larger than
+    // MAXCOMPRESSIONRATIO percent, the next COMPRESSIONBACKOFF messages are sent without trying
+    const size_t COMPRESSIONSAMPLESIZE = 64 * 1024;
+    const size_t MAXCOMPRESSIONRATIO = 90;
+    const size_t COMPRESSIONBACKOFF = 64;
+    template <class SOCKETTYPE> struct is_tls_socket : std::false_type {
+    };
+    template <class T> struct is_tls_socket<asio::ssl::stream<T>> : std::true_type {
+    };
+    // a call to onMessage or onDisconnection waiting for a worker. The message owns its buffer
+    struct HandlerEvent {
+        WSMessage Message = {};
+        bool Disconnected = false;
+        unsigned short Code = 0;
+        std::string Reason;
+    };
+    struct SendQueueItem {
+        WSMessage msg;
+        CompressionOptions compressmessage;
+        SendPriority priority;
+        // false for every fragment of a split message except the last
+        bool fin = true;
+        // true when msg is the remainder of a message whose first fragment was already sent
+        bool continuation = false;
+        // set when the payload is read from a file at fileoffset instead of from msg.data
+        std::shared_ptr<FileDescriptor> file;
+        size_t fileoffset = 0;
+        // msg is already deflated, rsv1 goes on its first frame
+        bool compressed = false;
+        // set when msg comes from a prepared message whose header can be sent as is
+        std::shared_ptr<PreparedMessage> prepared;
+    };
     // forward declares
     struct ThreadContext;
+    template <bool isServer, class SOCKETTYPE> class WebSocket;
     template <bool isServer, class SOCKETTYPE> void ReadHeaderNext(const SOCKETTYPE &socket, const std::shared_ptr<asio::streambuf> &extradata);
     template <bool isServer, class SOCKETTYPE> void ReadHeaderStart(const SOCKETTYPE &socket, const std::shared_ptr<asio::streambuf> &extradata);
-    template <bool isServer, class SOCKETTYPE, class SENDBUFFERTYPE> void write_end(const SOCKETTYPE &socket, const SENDBUFFERTYPE &msg);
+    template <bool isServer, class SOCKETTYPE> void write_end(const SOCKETTYPE &socket);
     template <bool isServer, class SOCKETTYPE, class SENDBUFFERTYPE>
-    void sendImpl(const SOCKETTYPE &socket, const SENDBUFFERTYPE &msg, CompressionOptions compressmessage);
+    SendStatus sendImpl(const SOCKETTYPE &socket, const SENDBUFFERTYPE &msg, CompressionOptions compressmessage,
+                        SendPriority priority = SendPriority::NORMAL);
     template <bool isServer, class SOCKETTYPE> void sendclosemessage(const SOCKETTYPE &socket, unsigned short code, const std::string &msg);
 
     inline size_t ReadFromExtraData(unsigned char *dst, size_t desired_bytes_to_read, const std::shared_ptr<asio::streambuf> &extradata)
@@ -33,6 +89,38 @@ namespace WS_LITE {
         }
         return dataconsumed;
     }
+    // fills dst with size bytes, taking what it can from extradata before going to the socket
+    template <class SOCKETTYPE, class HANDLER>
+    void ReadInto(const SOCKETTYPE &socket, unsigned char *dst, size_t size, const std::shared_ptr<asio::streambuf> &extradata, HANDLER handler)
+    {
+        auto dataconsumed = ReadFromExtraData(dst, size, extradata);
+        if (dataconsumed == size) {
+            if (socket->InlineReads < MAXINLINEREADS) {
+                socket->InlineReads += 1;
+                handler(std::error_code());
+                socket->InlineReads -= 1;
+            }
+            else {
+                socket->Socket.get_io_service().post([handler]() { handler(std::error_code()); });
+            }
+            return;
+        }
+        auto bytestoread = size - dataconsumed;
+        socket->Parent->Reads.fetch_add(1, std::memory_order_relaxed);
+        if (bytestoread >= READAHEADTHRESHOLD) {
+            asio::async_read(socket->Socket, asio::buffer(dst + dataconsumed, bytestoread),
+                             [handler](const std::error_code &ec, size_t) { handler(ec); });
+        }
+        else {
+            asio::async_read(socket->Socket, *extradata, asio::transfer_at_least(bytestoread),
+                             [dst, dataconsumed, bytestoread, extradata, handler](const std::error_code &ec, size_t) {
+                                 if (!ec) {
+                                     ReadFromExtraData(dst + dataconsumed, bytestoread, extradata);
+                                 }
+                                 handler(ec);
+                             });
+        }
+    }
     template <bool isServer, class SOCKETTYPE> void readexpire_from_now(const SOCKETTYPE &socket, std::chrono::seconds secs)
     {
         std::error_code ec;
@@ -62,13 +150,12 @@ namespace WS_LITE {
         else if (secs.count() > 0) {
             socket->ping_deadline.async_wait([socket, secs](const std::error_code &ec) {
                 if (ec != asio::error::operation_aborted) {
+                    // the payload is never written to, so every socket shares it and it needs no owner
+                    static unsigned char ping[] = "ping";
                     WSMessage msg;
-                    char p[] = "ping";
-                    msg.Buffer = std::shared_ptr<unsigned char>(new unsigned char[sizeof(p)], [](unsigned char *ptr) { delete[] ptr; });
-                    memcpy(msg.Buffer.get(), p, sizeof(p));
-                    msg.len = sizeof(p);
+                    msg.len = sizeof(ping);
                     msg.code = OpCode::PING;
-                    msg.data = msg.Buffer.get();
+                    msg.data = ping;
                     sendImpl<isServer>(socket, msg, CompressionOptions::NO_COMPRESSION);
                     start_ping<isServer>(socket, secs);
                 }
@@ -94,49 +181,19 @@ namespace WS_LITE {
         }
     }
 
-    template <bool isServer, class SOCKETTYPE, class SENDBUFFERTYPE> void writeend(const SOCKETTYPE &socket, const SENDBUFFERTYPE &msg, bool iserver)
-    {
-        if (!iserver) {
-            std::uniform_int_distribution<unsigned int> dist(0, 255);
-            std::random_device rd;
+    inline bool isControlFrame(OpCode code) { return code == OpCode::PING || code == OpCode::PONG || code == OpCode::CLOSE; }
 
-            unsigned char mask[4];
-            for (auto c = 0; c < 4; c++) {
-                mask[c] = static_cast<unsigned char>(dist(rd));
-            }
-            auto p = reinterpret_cast<unsigned char *>(msg.data);
-            for (decltype(msg.len) i = 0; i < msg.len; i++) {
-                *p++ ^= mask[i % 4];
-            }
-            std::error_code ec;
-            auto bytes_transferred = asio::write(socket->Socket, asio::buffer(mask, 4), ec);
-            if (ec) {
-                if (msg.code == OpCode::CLOSE) {
-                    return handleclose(socket, msg.code, "");
-                }
-                else {
-                    return handleclose(socket, 1002, "write mask failed " + ec.message());
-                }
-            }
-            else {
-                UNUSED(bytes_transferred);
-                assert(bytes_transferred == 4);
-                write_end<isServer>(socket, msg);
-            }
-        }
-        else {
-            write_end<isServer>(socket, msg);
-        }
-    }
-    template <bool isServer, class SOCKETTYPE, class SENDBUFFERTYPE> inline void write(const SOCKETTYPE &socket, const SENDBUFFERTYPE &msg)
+    // writes the frame header for item into header and returns its size, which includes the 4 byte mask key for clients
+    template <bool isServer, class SENDQUEUEITEM> inline size_t writeheader(unsigned char *header, const SENDQUEUEITEM &item, RandomPool &random)
     {
+        auto &msg = item.msg;
         size_t sendsize = 0;
-        unsigned char header[10] = {};
+        memset(header, 0, MAXHEADERSIZE);
 
-        setFin(header, 0xFF);
+        setFin(header, item.fin ? 0xFF : 0x00);
         set_MaskBitForSending(header, isServer);
-        setOpCode(header, msg.code);
-        setrsv1(header, 0x00);
+        setOpCode(header, item.continuation ? OpCode::CONTINUATION : msg.code);
+        setrsv1(header, item.compressed && !item.continuation ? 0xFF : 0x00);
         setrsv2(header, 0x00);
         setrsv3(header, 0x00);
 
@@ -156,76 +213,430 @@ namespace WS_LITE {
         }
 
         assert(msg.len < UINT32_MAX);
-        writeexpire_from_now<isServer>(socket, socket->Parent->WriteTimeout);
-        std::error_code ec;
-        auto bytes_transferred = asio::write(socket->Socket, asio::buffer(header, sendsize), ec);
-        UNUSED(bytes_transferred);
-        if (!ec) {
-            assert(sendsize == bytes_transferred);
-            writeend<isServer>(socket, msg, isServer);
+        if (!isServer) {
+            // the mask key travels in the header buffer so header, mask and payload go out in a single write
+            random.get(header + sendsize, 4);
+            sendsize += 4;
+        }
+        return sendsize;
+    }
+    // the ready made header of a prepared message, or nullptr when the frame needs its own. Clients mask every frame with a fresh key and
+    // fragments need their own length, so only whole server frames can use it
+    template <bool isServer, class SENDQUEUEITEM> inline const unsigned char *preparedheader(const SENDQUEUEITEM &item, size_t &size)
+    {
+        if (!isServer || !item.prepared || !item.fin || item.continuation) {
+            return nullptr;
+        }
+        size = item.compressed ? item.prepared->CompressedHeaderSize : item.prepared->HeaderSize;
+        return item.compressed ? item.prepared->CompressedHeader : item.prepared->Header;
+    }
+    template <bool isServer, class SOCKETTYPE> inline void write(const SOCKETTYPE &socket)
+    {
+        auto &batch = socket->SendBatch;
+        // the header storage and coalesce buffer are sized up front so the buffer sequence never points into memory that moves
+        socket->SendHeaders.resize(batch.size());
+        socket->SendBuffers.clear();
+
+        size_t coalescesize = 0;
+        size_t stagingsize = 0;
+        auto &headersizes = socket->SendHeaderSizes;
+        headersizes.resize(batch.size());
+        for (size_t i = 0; i < batch.size(); i++) {
+            auto len = batch[i].msg.len;
+            if (!preparedheader<isServer>(batch[i], headersizes[i])) {
+                headersizes[i] = writeheader<isServer>(socket->SendHeaders[i].data(), batch[i], socket->Parent->Random);
+            }
+            if (is_tls_socket<decltype(socket->Socket)>::value) {
+                coalescesize += headersizes[i];
+                if (len <= TLS_COALESCE_SIZE) {
+                    coalescesize += len;
+                }
+                else if (!isServer) {
+                    stagingsize += len;
+                }
+            }
+            else if (!isServer) {
+                stagingsize += len;
+            }
+        }
+
+        // payloads are never modified in place because the same buffer may be sent to several sockets or sent again. Client frames are
+        // masked into the per connection staging buffer instead
+        socket->SendMaskBuffer.resize(stagingsize);
+        auto staging = socket->SendMaskBuffer.data();
+        auto copypayload = [&](unsigned char *dst, size_t i) {
+            auto &msg = batch[i].msg;
+            if (isServer) {
+                memcpy(dst, msg.data, msg.len);
+            }
+            else {
+                ApplyMask(dst, msg.data, msg.len, socket->SendHeaders[i].data() + headersizes[i] - 4);
+            }
+        };
+        auto headerdata = [&](size_t i) {
+            size_t size = 0;
+            auto prepared = preparedheader<isServer>(batch[i], size);
+            return prepared ? prepared : socket->SendHeaders[i].data();
+        };
+        auto payloadbuffer = [&](size_t i) {
+            auto &msg = batch[i].msg;
+            if (isServer) {
+                return asio::const_buffer(msg.data, msg.len);
+            }
+            copypayload(staging, i);
+            staging += msg.len;
+            return asio::const_buffer(staging - msg.len, msg.len);
+        };
+
+        if (is_tls_socket<decltype(socket->Socket)>::value) {
+            // an ssl stream turns every buffer of a sequence into its own record, so runs of small frames are copied into one contiguous
+            // buffer and only large payloads are referenced directly
+            socket->SendCoalesceBuffer.resize(coalescesize);
+            auto start = socket->SendCoalesceBuffer.data();
+            auto end = start;
+            for (size_t i = 0; i < batch.size(); i++) {
+                auto &msg = batch[i].msg;
+                memcpy(end, headerdata(i), headersizes[i]);
+                end += headersizes[i];
+                if (msg.len <= TLS_COALESCE_SIZE) {
+                    if (msg.len > 0) {
+                        copypayload(end, i);
+                        end += msg.len;
+                    }
+                }
+                else {
+                    socket->SendBuffers.emplace_back(asio::buffer(start, end - start));
+                    socket->SendBuffers.emplace_back(payloadbuffer(i));
+                    start = end;
+                }
+            }
+            if (end != start) {
+                socket->SendBuffers.emplace_back(asio::buffer(start, end - start));
+            }
         }
         else {
-            handleclose(socket, 1002, "write header failed " + ec.message());
+            for (size_t i = 0; i < batch.size(); i++) {
+                socket->SendBuffers.emplace_back(asio::buffer(headerdata(i), headersizes[i]));
+                if (batch[i].msg.len > 0 && !batch[i].file) {
+                    socket->SendBuffers.emplace_back(payloadbuffer(i));
+                }
+            }
+        }
+        socket->FileBytesSent = 0;
+        writeexpire_from_now<isServer>(socket, socket->Parent->WriteTimeout);
+        write_end<isServer>(socket);
+    }
+    // takes the next frame to send off the queues. Control frames always go first, then the rest of a partly sent message because data
+    // messages cannot be interleaved, then the highest priority message waiting. Messages larger than MaxFrameSize are split, the first
+    // fragment is returned and the remainder stays at the front of its queue
+    template <class SOCKETTYPE> inline auto nextframe(const SOCKETTYPE &socket)
+    {
+        auto &queues = socket->SendMessageQueues;
+        auto queue = std::find_if(queues.begin(), queues.end(), [](const auto &q) { return !q.empty(); });
+        if (queue != queues.begin()) {
+            auto inprogress = std::find_if(queues.begin(), queues.end(), [](const auto &q) { return !q.empty() && q.front().continuation; });
+            if (inprogress != queues.end()) {
+                queue = inprogress;
+            }
         }
+        auto item(std::move(queue->front()));
+        queue->pop_front();
+        if (socket->ExtensionOption == ExtensionOptions::DEFLATE && !item.continuation && !item.file && item.msg.len > 0 &&
+            (item.msg.code == OpCode::TEXT || item.msg.code == OpCode::BINARY) &&
+            (item.compressed ? item.prepared != nullptr : item.compressmessage == CompressionOptions::COMPRESS)) {
+            socket->DeflateMessage(item);
+        }
+        auto maxframesize = socket->Parent->MaxFrameSize;
+        if (maxframesize > 0 && !isControlFrame(item.msg.code) && item.msg.len > maxframesize) {
+            auto remainder(item);
+            if (remainder.file) {
+                remainder.fileoffset += maxframesize;
+            }
+            else {
+                remainder.msg.data += maxframesize;
+            }
+            remainder.msg.len -= maxframesize;
+            remainder.continuation = true;
+            queue->push_front(std::move(remainder));
+            item.msg.len = maxframesize;
+            item.fin = false;
+        }
+        return item;
     }
     template <bool isServer, class SOCKETTYPE> inline void startwrite(const SOCKETTYPE &socket)
     {
         if (socket->Writing == SocketIOStatus::NOTWRITING) {
-            if (!socket->SendMessageQueue.empty()) {
+            if (!socket->SendQueueEmpty()) {
                 socket->Writing = SocketIOStatus::WRITING;
-                auto msg(socket->SendMessageQueue.front());
-                socket->SendMessageQueue.pop_front();
-                write<isServer>(socket, msg.msg);
+                // drain queued frames into a single write until the flush limits are reached. Each frame needs up to two buffers, one for
+                // the header and one for the payload. At least one frame is always taken no matter its size
+                auto maxframes = std::max<size_t>(socket->Parent->MaxFlushBuffers / 2, 1);
+                size_t batchbytes = 0;
+                while (!socket->SendQueueEmpty() && socket->SendBatch.size() < maxframes &&
+                       (socket->SendBatch.empty() || batchbytes < socket->Parent->MaxFlushBytes)) {
+                    socket->SendBatch.emplace_back(nextframe(socket));
+                    batchbytes += socket->SendBatch.back().msg.len;
+                    if (socket->SendBatch.back().msg.code == OpCode::CLOSE) {
+                        break; // nothing goes out after a close
+                    }
+                    if (socket->SendBatch.back().file) {
+                        break; // the payload of a file frame has to follow its header directly
+                    }
+                }
+                write<isServer>(socket);
             }
             else {
                 writeexpire_from_now<isServer>(socket, std::chrono::seconds(0)); // make sure the write timer doesnt kick off
             }
         }
     }
-    template <bool isServer, class SOCKETTYPE, class SENDBUFFERTYPE>
-    void sendImpl(const SOCKETTYPE &socket, const SENDBUFFERTYPE &msg, CompressionOptions compressmessage)
+    // counts a message against the outbound limits of the socket before it is queued, from any thread, and applies the overflow policy
+    // of the hub when it does not fit. Anything but QUEUED means the message must not be queued
+    template <bool isServer, class SOCKETTYPE> SendStatus reserveSend(const SOCKETTYPE &socket, size_t len, OpCode code)
     {
-        if (compressmessage == CompressionOptions::COMPRESS) {
-            assert(msg.code == OpCode::BINARY || msg.code == OpCode::TEXT);
+        auto bytes = socket->Bytes_PendingFlush.fetch_add(len, std::memory_order_relaxed) + len;
+        auto messages = socket->Messages_PendingFlush.fetch_add(1, std::memory_order_relaxed) + 1;
+        socket->NotePending(bytes);
+        auto policy = socket->Parent->OverflowPolicy_;
+        if (isControlFrame(code) || !socket->QueueLimitExceeded(bytes, messages) || policy == OverflowPolicy::DROP_OLDEST) {
+            return SendStatus::QUEUED; // DROP_OLDEST makes room once the message is queued
         }
-
-        socket->Socket.get_io_service().post([socket, msg, compressmessage]() {
-
+        socket->ReleaseSend(len, true);
+        switch (policy) {
+        case OverflowPolicy::REJECT:
+            socket->Parent->SendsRejected.fetch_add(1, std::memory_order_relaxed);
+            return SendStatus::REJECTED;
+        case OverflowPolicy::DROP_NEWEST:
+            socket->Parent->MessagesDropped.fetch_add(1, std::memory_order_relaxed);
+            return SendStatus::DROPPED;
+        default:
+            if (!socket->OverflowClosed.exchange(true)) {
+                socket->Parent->OverflowCloses.fetch_add(1, std::memory_order_relaxed);
+                sendclosemessage<isServer>(socket, policy == OverflowPolicy::CLOSE_POLICY_VIOLATION ? 1008 : 1013, "send queue full");
+            }
+            return SendStatus::CLOSING;
+        }
+    }
+    // moves what other threads sent into the send queues. However many sends there were, they cost a single post
+    template <bool isServer, class SOCKETTYPE> void drainOutbox(const SOCKETTYPE &socket)
+    {
+        socket->OutboxScheduled.store(false);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        SendQueueItem item;
+        auto queued = false;
+        while (socket->Outbox.pop(item)) {
             if (socket->SocketStatus_ == SocketStatus::CONNECTED) {
                 // update the socket status to reflect it is closing to prevent other messages from being sent.. this is the last valid message
                 // make sure to do this after a call to write so the write process sends the close message, but no others
-                if (msg.code == OpCode::CLOSE) {
+                if (item.msg.code == OpCode::CLOSE) {
                     socket->SocketStatus_ = SocketStatus::CLOSING;
                 }
-                socket->Bytes_PendingFlush += msg.len;
-                socket->AddMsg(msg, compressmessage);
-                startwrite<isServer>(socket);
+                socket->AddMsg(std::move(item));
+                queued = true;
+            }
+            else {
+                socket->ReleaseSend(item.msg.len, true);
+            }
+        }
+        // a producer was half way through a push that had already seen the flag set
+        if (!socket->Outbox.empty() && !socket->OutboxScheduled.exchange(true)) {
+            socket->Socket.get_io_service().post([socket]() { drainOutbox<isServer>(socket); });
+        }
+        if (queued) {
+            startwrite<isServer>(socket);
+        }
+    }
+    template <bool isServer, class SOCKETTYPE> void pushOutbox(const SOCKETTYPE &socket, SendQueueItem item)
+    {
+        socket->Outbox.push(std::move(item));
+        if (!socket->OutboxScheduled.exchange(true)) {
+            socket->Socket.get_io_service().post([socket]() { drainOutbox<isServer>(socket); });
+        }
+    }
+    template <bool isServer, class SOCKETTYPE, class SENDBUFFERTYPE>
+    SendStatus sendImpl(const SOCKETTYPE &socket, const SENDBUFFERTYPE &msg, CompressionOptions compressmessage, SendPriority priority)
+    {
+        if (compressmessage == CompressionOptions::COMPRESS) {
+            assert(msg.code == OpCode::BINARY || msg.code == OpCode::TEXT);
+        }
+        auto status = reserveSend<isServer>(socket, msg.len, msg.code);
+        if (status == SendStatus::QUEUED) {
+            pushOutbox<isServer>(socket, SendQueueItem{msg, compressmessage, priority});
+        }
+        return status;
+    }
+    template <bool isServer, class SOCKETTYPE>
+    SendStatus sendFileImpl(const SOCKETTYPE &socket, const std::shared_ptr<FileDescriptor> &file, size_t offset, size_t length, OpCode code,
+                            SendPriority priority)
+    {
+        auto status = reserveSend<isServer>(socket, length, code);
+        if (status == SendStatus::QUEUED) {
+            WSMessage msg;
+            msg.data = nullptr;
+            msg.len = length;
+            msg.code = code;
+            SendQueueItem item{msg, CompressionOptions::NO_COMPRESSION, priority};
+            item.file = file;
+            item.fileoffset = offset;
+            pushOutbox<isServer>(socket, std::move(item));
+        }
+        return status;
+    }
+    // the frame a prepared message puts on this socket
+    template <class SOCKETTYPE>
+    SendQueueItem preparedItem(const SOCKETTYPE &socket, const std::shared_ptr<PreparedMessage> &prepared, SendPriority priority)
+    {
+        // back references in the deflated copy may reach further than a peer with a smaller window can look
+        auto compressed = socket->ExtensionOption == ExtensionOptions::DEFLATE && prepared->Compressed.Buffer &&
+                          socket->DeflateWindowBits >= prepared->CompressedWindowBits;
+        SendQueueItem item{compressed ? prepared->Compressed : prepared->Message, CompressionOptions::NO_COMPRESSION, priority};
+        item.compressed = compressed;
+        item.prepared = prepared;
+        return item;
+    }
+    template <bool isServer, class SOCKETTYPE>
+    SendStatus sendPreparedImpl(const SOCKETTYPE &socket, const std::shared_ptr<PreparedMessage> &prepared, SendPriority priority)
+    {
+        auto item = preparedItem(socket, prepared, priority);
+        auto status = reserveSend<isServer>(socket, item.msg.len, item.msg.code);
+        if (status == SendStatus::QUEUED) {
+            pushOutbox<isServer>(socket, std::move(item));
+        }
+        return status;
+    }
+    // how a topic delivers to a subscriber without knowing its socket type. Publishing runs on the thread of the socket, so this can
+    // queue directly
+    template <bool isServer, class SOCKETTYPE>
+    void sendPublished(const std::shared_ptr<IWebSocket> &socket, const std::shared_ptr<PreparedMessage> &prepared)
+    {
+        auto s = std::static_pointer_cast<WebSocket<isServer, SOCKETTYPE>>(socket);
+        auto item = preparedItem(s, prepared, SendPriority::NORMAL);
+        if (s->SocketStatus_ == SocketStatus::CONNECTED && reserveSend<isServer>(s, item.msg.len, item.msg.code) == SendStatus::QUEUED) {
+            s->AddMsg(std::move(item));
+            startwrite<isServer>(s);
+        }
+    }
+    // topics are kept by the thread of the socket, so these post to it
+    template <bool isServer, class SOCKETTYPE> void subscribe(const std::shared_ptr<IWebSocket> &s, const std::string &topic)
+    {
+        auto socket = std::static_pointer_cast<WebSocket<isServer, SOCKETTYPE>>(s);
+        socket->Socket.get_io_service().post([socket, topic]() {
+            if (socket->SocketStatus_ == SocketStatus::CONNECTED &&
+                std::find(socket->Topics.begin(), socket->Topics.end(), topic) == socket->Topics.end()) {
+                socket->Topics.push_back(topic);
+                socket->Parent->Subscribe(topic, socket, &sendPublished<isServer, SOCKETTYPE>);
             }
         });
     }
+    template <bool isServer, class SOCKETTYPE> void unsubscribe(const std::shared_ptr<IWebSocket> &s, const std::string &topic)
+    {
+        auto socket = std::static_pointer_cast<WebSocket<isServer, SOCKETTYPE>>(s);
+        socket->Socket.get_io_service().post([socket, topic]() {
+            auto it = std::find(socket->Topics.begin(), socket->Topics.end(), topic);
+            if (it != socket->Topics.end()) {
+                socket->Topics.erase(it);
+                socket->Parent->Unsubscribe(topic, socket.get());
+            }
+        });
+    }
+    // gives the window of an idle socket back to the inflate budget. The peer would go on deflating against it, so the socket is closed
+    template <bool isServer, class WEBSOCKET> void evictInflater(const std::shared_ptr<IWebSocket> &s)
+    {
+        auto socket = std::static_pointer_cast<WEBSOCKET>(s);
+        // the close is only queued, frames that arrive before it goes out are dropped instead of inflated without the window
+        socket->InflaterEvicted = true;
+        socket->Inflater.release();
+        sendclosemessage<isServer>(socket, 1013, "Inflate memory budget exceeded");
+    }
     template <bool isServer, class SOCKETTYPE> void sendclosemessage(const SOCKETTYPE &socket, unsigned short code, const std::string &msg)
     {
         SL_WS_LITE_LOG(Logging_Levels::INFO_log_level, "closeImpl " << msg);
         WSMessage ws;
         ws.code = OpCode::CLOSE;
         ws.len = sizeof(code) + msg.size();
-        ws.Buffer = std::shared_ptr<unsigned char>(new unsigned char[ws.len], [](unsigned char *p) { delete[] p; });
+        ws.Buffer = AllocateBuffer(ws.len);
         *reinterpret_cast<unsigned short *>(ws.Buffer.get()) = ntoh(code);
         memcpy(ws.Buffer.get() + sizeof(code), msg.c_str(), msg.size());
         ws.data = ws.Buffer.get();
         sendImpl<isServer>(socket, ws, CompressionOptions::NO_COMPRESSION);
     }
 
+    // runs the events of one socket in order. Only one worker at a time does this for a socket: whoever takes HandlersPending from zero
+    // posts it, and it keeps going until it brings the count back to zero
+    template <class SOCKETTYPE> void runHandlers(const SOCKETTYPE &socket)
+    {
+        HandlerEvent event;
+        size_t handled = 0;
+        while (handled < MAXHANDLERBATCH && socket->Handlers.pop(event)) {
+            handled += 1;
+            if (event.Disconnected) {
+                socket->Parent->onDisconnection(socket, event.Code, event.Reason);
+            }
+            else {
+                socket->Parent->onMessage(socket, event.Message);
+            }
+            event = HandlerEvent();
+        }
+        if (socket->HandlersPending.fetch_sub(handled) != handled) {
+            socket->Parent->Workers->post([socket]() { runHandlers(socket); });
+        }
+    }
+    template <class SOCKETTYPE> void pushHandler(const SOCKETTYPE &socket, HandlerEvent event)
+    {
+        socket->Handlers.push(std::move(event));
+        if (socket->HandlersPending.fetch_add(1) == 0) {
+            socket->Parent->Workers->post([socket]() { runHandlers(socket); });
+        }
+    }
+    // a copy of unpacked that owns its data. The reassembly and inflate buffers are handed over rather than copied, the next message
+    // gets fresh ones from the pool
+    template <class SOCKETTYPE> WSMessage ownedMessage(const SOCKETTYPE &socket, const WSMessage &unpacked)
+    {
+        auto msg = unpacked;
+        if (!unpacked.data || unpacked.len == 0) {
+            msg.data = nullptr;
+            msg.len = 0;
+        }
+        else if (unpacked.data == socket->ReceiveBuffer) {
+            msg.Buffer = AdoptBuffer(socket->ReceiveBuffer, socket->ReceiveBufferCapacity);
+            socket->ReceiveBuffer = nullptr;
+            socket->ReceiveBufferCapacity = 0;
+        }
+        else if (!(msg.Buffer = socket->Parent->TakeInflated(unpacked.data))) {
+            // neither buffer, so it has to be copied
+            msg.Buffer = AllocateBuffer(unpacked.len);
+            memcpy(msg.Buffer.get(), unpacked.data, unpacked.len);
+            msg.data = msg.Buffer.get();
+        }
+        return msg;
+    }
+
     template <class SOCKETTYPE> inline void handleclose(const SOCKETTYPE &socket, unsigned short code, const std::string &msg)
     {
         SL_WS_LITE_LOG(Logging_Levels::INFO_log_level, "Closed: " << code);
         socket->SocketStatus_ = SocketStatus::CLOSED;
         socket->Writing = SocketIOStatus::NOTWRITING;
         if (socket->Parent->onDisconnection) {
-            socket->Parent->onDisconnection(socket, code, msg);
+            if (socket->Parent->Workers) {
+                // after the messages still waiting for a worker
+                HandlerEvent event;
+                event.Disconnected = true;
+                event.Code = code;
+                event.Reason = msg;
+                pushHandler(socket, std::move(event));
+            }
+            else {
+                socket->Parent->onDisconnection(socket, code, msg);
+            }
         }
 
-        socket->SendMessageQueue.clear(); // clear all outbound messages
+        socket->ClearSendQueues(); // clear all outbound messages
+        for (auto &topic : socket->Topics) {
+            socket->Parent->Unsubscribe(topic, socket.get());
+        }
+        socket->Topics.clear();
+        socket->Parent->TakeoverInflaters.erase(socket.get());
+        socket->Inflater.release();
         socket->canceltimers();
         std::error_code ec;
         socket->Socket.lowest_layer().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
@@ -233,36 +644,66 @@ namespace WS_LITE {
         socket->Socket.lowest_layer().close(ec);
     }
 
-    template <bool isServer, class SOCKETTYPE, class SENDBUFFERTYPE> void write_end(const SOCKETTYPE &socket, const SENDBUFFERTYPE &msg)
+    template <bool isServer, class SOCKETTYPE> void write_complete(const SOCKETTYPE &socket, const std::error_code &ec)
     {
-
-        asio::async_write(socket->Socket, asio::buffer(msg.data, msg.len), [socket, msg](const std::error_code &ec, size_t bytes_transferred) {
-            socket->Writing = SocketIOStatus::NOTWRITING;
+        socket->Writing = SocketIOStatus::NOTWRITING;
+        auto closing = false;
+        for (auto &item : socket->SendBatch) {
+            socket->FrameSent(item);
+            closing = closing || item.msg.code == OpCode::CLOSE;
+        }
+        socket->Parent->Flushes.fetch_add(1, std::memory_order_relaxed);
+        socket->Parent->FramesFlushed.fetch_add(socket->SendBatch.size(), std::memory_order_relaxed);
+        socket->SendBatch.clear();
+        if (socket->SendMaskBuffer.capacity() > MAX_RETAINED_STAGING_SIZE) {
+            // dont hold on to the memory of an unusually large message for the rest of the connection
+            std::vector<unsigned char>().swap(socket->SendMaskBuffer);
+        }
+        if (closing) {
+            // final close.. get out and dont come back mm kay?
+            return handleclose(socket, 1000, "");
+        }
+        if (ec) {
+            return handleclose(socket, 1002, "write failed " + ec.message());
+        }
+        startwrite<isServer>(socket);
+        if (socket->DrainPending()) {
+            socket->Parent->onDrain(socket);
+        }
+    }
+    // writes the payload of the file frame that ends the current batch straight from the file to the socket
+    template <bool isServer, class SOCKETTYPE> void write_file(const SOCKETTYPE &socket)
+    {
+        auto &item = socket->SendBatch.back();
+        std::error_code ec;
+        socket->Socket.native_non_blocking(true, ec);
+        while (!ec && socket->FileBytesSent < item.msg.len) {
+            socket->FileBytesSent += SendFileRegion(socket->Socket.native_handle(), item.file->Fd, item.fileoffset + socket->FileBytesSent,
+                                                    item.msg.len - socket->FileBytesSent, ec);
+        }
+        if (ec == std::errc::operation_would_block) {
+            return socket->Socket.async_wait(asio::ip::tcp::socket::wait_write, [socket](const std::error_code &ec) {
+                if (ec) {
+                    return write_complete<isServer>(socket, ec);
+                }
+                write_file<isServer>(socket);
+            });
+        }
+        write_complete<isServer>(socket, ec);
+    }
+    template <bool isServer, class SOCKETTYPE> void write_end(const SOCKETTYPE &socket)
+    {
+        asio::async_write(socket->Socket, socket->SendBuffers, [socket](const std::error_code &ec, size_t bytes_transferred) {
             UNUSED(bytes_transferred);
-            socket->Bytes_PendingFlush -= msg.len;
-            if (msg.code == OpCode::CLOSE) {
-                // final close.. get out and dont come back mm kay?
-                return handleclose(socket, 1000, "");
-            }
-            if (ec) {
-                return handleclose(socket, 1002, "write header failed " + ec.message());
+            if constexpr (!is_tls_socket<decltype(socket->Socket)>::value) {
+                if (!ec && socket->SendBatch.back().file) {
+                    return write_file<isServer>(socket);
+                }
             }
-            assert(msg.len == bytes_transferred);
-            startwrite<isServer>(socket);
+            write_complete<isServer>(socket, ec);
         });
     }
 
-    inline void UnMaskMessage(size_t readsize, unsigned char *buffer, bool isserver)
-    {
-        if (isserver) {
-            auto startp = buffer;
-            unsigned char mask[4] = {};
-            memcpy(mask, startp, 4);
-            for (size_t c = 4; c < readsize; c++) {
-                startp[c - 4] = startp[c] ^ mask[c % 4];
-            }
-        }
-    }
     template <bool isServer, class SOCKETTYPE> inline void ProcessMessageFin(const SOCKETTYPE &socket, const WSMessage &unpacked, OpCode opcode)
     {
         if (socket->LastOpCode == OpCode::TEXT || opcode == OpCode::TEXT) {
@@ -271,7 +712,14 @@ namespace WS_LITE {
             }
         }
         if (socket->Parent->onMessage) {
-            socket->Parent->onMessage(socket, unpacked);
+            if (socket->Parent->Workers) {
+                HandlerEvent event;
+                event.Message = ownedMessage(socket, unpacked);
+                pushHandler(socket, std::move(event));
+            }
+            else {
+                socket->Parent->onMessage(socket, unpacked);
+            }
         }
     }
     template <bool isServer, class SOCKETTYPE> inline void ProcessMessage(const SOCKETTYPE &socket, const std::shared_ptr<asio::streambuf> &extradata)
@@ -303,8 +751,30 @@ namespace WS_LITE {
 
             // this could be compressed.... lets check it out
             if (socket->FrameCompressed || getrsv1(socket->ReceiveHeader)) { // is this the last of the messages? Decompress!!!
+                // a peer with context takeover deflates against what it sent before, so the window of this socket is used and kept.
+                // Once it was evicted, or the socket is closing, what is still coming cannot be inflated any more
+                auto takeover = !socket->InflateNoContextTakeover;
+                if (takeover && (socket->InflaterEvicted || socket->SocketStatus_ != SocketStatus::CONNECTED)) {
+                    return ReadHeaderStart<isServer>(socket, extradata);
+                }
+                if (!socket->ReserveReceiveBuffer(socket->ReceiveBufferSize + 4)) {
+                    return sendclosemessage<isServer>(socket, 1009, "Payload exceeded MaxPayload size");
+                }
+                // the tail permessage-deflate strips from every message
+                const unsigned char tail[] = {0x00, 0x00, 0xff, 0xff};
+                memcpy(socket->ReceiveBuffer + socket->ReceiveBufferSize, tail, sizeof(tail));
                 socket->Parent->beginInflate();
-                auto[buffer, buffer_length] = socket->Parent->Inflate(socket->ReceiveBuffer, socket->ReceiveBufferSize);
+                auto[buffer, buffer_length, closecode] =
+                    takeover ? socket->Parent->Inflate(socket->Inflater.get(), socket->ReceiveBuffer, socket->ReceiveBufferSize + sizeof(tail))
+                             : socket->Parent->Inflate(socket->ReceiveBuffer, socket->ReceiveBufferSize + sizeof(tail));
+                if (closecode != 0) {
+                    socket->Parent->endInflate();
+                    return sendclosemessage<isServer>(socket, closecode,
+                                                      closecode == 1009 ? "Payload exceeded MaxPayload size" : "Invalid compressed data");
+                }
+                if (takeover) {
+                    socket->Parent->InflaterUsed(socket, &evictInflater<isServer, typename SOCKETTYPE::element_type>);
+                }
                 auto unpacked = WSMessage{buffer, buffer_length, socket->LastOpCode != OpCode::INVALID ? socket->LastOpCode : opcode};
                 ProcessMessageFin<isServer>(socket, unpacked, opcode);
                 socket->Parent->endInflate();
@@ -318,29 +788,38 @@ namespace WS_LITE {
         }
     }
 
-    template <bool isServer, class SOCKETTYPE>
-    inline void SendPong(const SOCKETTYPE &socket, const std::shared_ptr<unsigned char> &buffer, size_t size)
+    template <bool isServer, class SOCKETTYPE> inline void SendPong(const SOCKETTYPE &socket, const unsigned char *data, size_t size)
     {
         WSMessage msg;
-        msg.Buffer = buffer;
+        if (!socket->PongPending) {
+            // the pong payload lives in the socket, the message holds on to the socket to keep it alive
+            memcpy(socket->PongBuffer, data, size);
+            msg.Buffer = std::shared_ptr<unsigned char>(socket, socket->PongBuffer);
+            socket->PongPending = true;
+        }
+        else {
+            // the last pong has not been written yet, so this one cannot reuse its buffer
+            msg.Buffer = AllocateBuffer(size);
+            memcpy(msg.Buffer.get(), data, size);
+        }
         msg.len = size;
         msg.code = OpCode::PONG;
         msg.data = msg.Buffer.get();
 
         sendImpl<isServer>(socket, msg, CompressionOptions::NO_COMPRESSION);
     }
-    template <bool isServer, class SOCKETTYPE>
-    inline void ProcessClose(const SOCKETTYPE &socket, const std::shared_ptr<unsigned char> &buffer, size_t size)
+    template <bool isServer, class SOCKETTYPE> inline void ProcessClose(const SOCKETTYPE &socket, unsigned char *buffer, size_t size)
     {
         if (size >= 2) {
-            auto closecode = hton(*reinterpret_cast<unsigned short *>(buffer.get()));
+            auto closecode = hton(*reinterpret_cast<unsigned short *>(buffer));
             if (size > 2) {
-                if (!isValidUtf8(buffer.get() + sizeof(closecode), size - sizeof(closecode))) {
+                if (!isValidUtf8(buffer + sizeof(closecode), size - sizeof(closecode))) {
                     return sendclosemessage<isServer>(socket, 1007, "Frame not valid utf8");
                 }
             }
 
-            if (((closecode >= 1000 && closecode <= 1011) || (closecode >= 3000 && closecode <= 4999)) && closecode != 1004 && closecode != 1005 &&
+            // 1012 to 1014 were registered after RFC 6455, 1013 is sent when a send queue overflows
+            if (((closecode >= 1000 && closecode <= 1014) || (closecode >= 3000 && closecode <= 4999)) && closecode != 1004 && closecode != 1005 &&
                 closecode != 1006) {
                 return sendclosemessage<isServer>(socket, 1000, "");
             }
@@ -354,8 +833,7 @@ namespace WS_LITE {
         return sendclosemessage<isServer>(socket, 1000, "");
     }
     template <bool isServer, class SOCKETTYPE>
-    inline void ProcessControlMessage(const SOCKETTYPE &socket, const std::shared_ptr<unsigned char> &buffer, size_t size,
-                                      const std::shared_ptr<asio::streambuf> &extradata)
+    inline void ProcessControlMessage(const SOCKETTYPE &socket, unsigned char *buffer, size_t size, const std::shared_ptr<asio::streambuf> &extradata)
     {
         if (!getFin(socket->ReceiveHeader)) {
             return sendclosemessage<isServer>(socket, 1002, "Closing connection. Control Frames must be Fin");
@@ -365,13 +843,13 @@ namespace WS_LITE {
         switch (opcode) {
         case OpCode::PING:
             if (socket->Parent->onPing) {
-                socket->Parent->onPing(socket, buffer.get(), size);
+                socket->Parent->onPing(socket, buffer, size);
             }
             SendPong<isServer>(socket, buffer, size);
             break;
         case OpCode::PONG:
             if (socket->Parent->onPong) {
-                socket->Parent->onPong(socket, buffer.get(), size);
+                socket->Parent->onPong(socket, buffer, size);
             }
             break;
         case OpCode::CLOSE:
@@ -383,6 +861,104 @@ namespace WS_LITE {
         ReadHeaderNext<isServer>(socket, extradata);
     }
 
+    // hands a piece of a streamed message to onMessageChunk, inflating and validating it first. Returns false if the socket is closing
+    template <bool isServer, class SOCKETTYPE> bool DeliverStreamChunk(const SOCKETTYPE &socket, unsigned char *data, size_t len, bool last)
+    {
+        auto opcode = socket->LastOpCode;
+        auto deliver = [&](unsigned char *d, size_t l, bool final) {
+            socket->StreamDelivered += l;
+            if (socket->StreamDelivered > socket->Parent->MaxPayload) {
+                sendclosemessage<isServer>(socket, 1009, "Payload exceeded MaxPayload size");
+                return false;
+            }
+            if (opcode == OpCode::TEXT && !socket->StreamUtf8.validate(d, l, final)) {
+                sendclosemessage<isServer>(socket, 1007, "Frame not valid utf8");
+                return false;
+            }
+            socket->Parent->onMessageChunk(socket, d, l, opcode, final);
+            return true;
+        };
+        if (!socket->FrameCompressed) {
+            return (len == 0 && !last) || deliver(data, len, last);
+        }
+        if (socket->InflaterEvicted) {
+            // see evictInflater, the rest of the message is read and dropped
+            return true;
+        }
+        if (last) {
+            // the tail permessage-deflate strips from every message, the buffer has room for it
+            const unsigned char tail[] = {0x00, 0x00, 0xff, 0xff};
+            memcpy(data + len, tail, sizeof(tail));
+            len += sizeof(tail);
+        }
+        if (!socket->Parent->InflateChunk(socket->Inflater.get(), data, len, last, deliver)) {
+            if (socket->SocketStatus_ == SocketStatus::CONNECTED) {
+                sendclosemessage<isServer>(socket, 1007, "Invalid compressed data");
+            }
+            return false;
+        }
+        if (last && !socket->InflateNoContextTakeover) {
+            socket->Parent->InflaterUsed(socket, &evictInflater<isServer, typename SOCKETTYPE::element_type>);
+        }
+        return true;
+    }
+    // reads the next piece of the frame being streamed, at most STREAMCHUNKSIZE bytes
+    template <bool isServer, class SOCKETTYPE> void ReadStreamChunk(const SOCKETTYPE &socket, const std::shared_ptr<asio::streambuf> &extradata)
+    {
+        auto size = std::min(socket->StreamRemaining, STREAMCHUNKSIZE);
+        if (!socket->ReserveReceiveBuffer(size + 4)) {
+            SL_WS_LITE_LOG(Logging_Levels::ERROR_log_level, "MEMORY ALLOCATION ERROR!!! Tried to realloc " << size);
+            return sendclosemessage<isServer>(socket, 1009, "Payload exceeded MaxPayload size");
+        }
+        ReadInto(socket, socket->ReceiveBuffer, size, extradata, [socket, extradata, size](const std::error_code &ec) {
+            if (ec) {
+                return sendclosemessage<isServer>(socket, 1002, "ReadBody Error " + ec.message());
+            }
+            if (isServer) {
+                ApplyMask(socket->ReceiveBuffer, socket->ReceiveBuffer, size, getMaskKey(socket->ReceiveHeader), socket->StreamMaskOffset);
+                socket->StreamMaskOffset += size;
+            }
+            socket->StreamRemaining -= size;
+            auto last = getFin(socket->ReceiveHeader) && socket->StreamRemaining == 0;
+            if (!DeliverStreamChunk<isServer>(socket, socket->ReceiveBuffer, size, last)) {
+                return;
+            }
+            if (socket->StreamRemaining > 0) {
+                return ReadStreamChunk<isServer>(socket, extradata);
+            }
+            if (last) {
+                return ReadHeaderStart<isServer>(socket, extradata);
+            }
+            ReadHeaderNext<isServer>(socket, extradata);
+        });
+    }
+    // onMessageChunk replaces onMessage: the payload of data frames is handed over as it arrives instead of being reassembled
+    template <bool isServer, class SOCKETTYPE>
+    void ReadStreamFrame(const SOCKETTYPE &socket, size_t size, const std::shared_ptr<asio::streambuf> &extradata)
+    {
+        auto opcode = static_cast<OpCode>(getOpCode(socket->ReceiveHeader));
+        if (socket->LastOpCode == OpCode::INVALID) {
+            // the same reasons ProcessMessage gives
+            if (getFin(socket->ReceiveHeader) && opcode == OpCode::CONTINUATION) {
+                return sendclosemessage<isServer>(socket, 1002, "Continuation Received without a previous frame");
+            }
+            if (opcode != OpCode::BINARY && opcode != OpCode::TEXT) {
+                return sendclosemessage<isServer>(socket, 1002, "First Non Fin Frame must be binary or text");
+            }
+            socket->LastOpCode = opcode;
+            socket->FrameCompressed = socket->ExtensionOption == ExtensionOptions::DEFLATE && getrsv1(socket->ReceiveHeader);
+        }
+        else if (opcode != OpCode::CONTINUATION) {
+            return sendclosemessage<isServer>(socket, 1002, "Continuation Received without a previous frame");
+        }
+        if (size > socket->Parent->MaxPayload - std::min(socket->StreamReceived, socket->Parent->MaxPayload)) {
+            return sendclosemessage<isServer>(socket, 1009, "Payload exceeded MaxPayload size");
+        }
+        socket->StreamReceived += size;
+        socket->StreamRemaining = size;
+        socket->StreamMaskOffset = 0;
+        ReadStreamChunk<isServer>(socket, extradata);
+    }
     template <bool isServer, class SOCKETTYPE> inline void ReadBody(const SOCKETTYPE &socket, const std::shared_ptr<asio::streambuf> &extradata)
     {
         if (!DidPassMaskRequirement(socket->ReceiveHeader, isServer)) { // Close connection if it did not meet the mask requirement.
@@ -392,6 +968,7 @@ namespace WS_LITE {
             (getrsv1(socket->ReceiveHeader) && socket->ExtensionOption == ExtensionOptions::NO_OPTIONS)) {
             return sendclosemessage<isServer>(socket, 1002, "Closing connection. rsv bit set");
         }
+        socket->Parent->FramesReceived.fetch_add(1, std::memory_order_relaxed);
         auto opcode = static_cast<OpCode>(getOpCode(socket->ReceiveHeader));
 
         size_t size = getpayloadLength1(socket->ReceiveHeader);
@@ -409,37 +986,28 @@ namespace WS_LITE {
             break;
         }
 
-        size += AdditionalBodyBytesToRead(isServer);
         if (opcode == OpCode::PING || opcode == OpCode::PONG || opcode == OpCode::CLOSE) {
-            if (size - AdditionalBodyBytesToRead(isServer) > CONTROLBUFFERMAXSIZE) {
+            if (size > CONTROLBUFFERMAXSIZE) {
                 return sendclosemessage<isServer>(socket, 1002, "Payload exceeded for control frames. Size requested " + std::to_string(size));
             }
-            else if (size > 0) {
-                auto buffer = std::shared_ptr<unsigned char>(new unsigned char[size], [](unsigned char *p) { delete[] p; });
-
-                auto bytestoread = size;
-                auto dataconsumed = ReadFromExtraData(buffer.get(), bytestoread, extradata);
-                bytestoread -= dataconsumed;
-
-                asio::async_read(socket->Socket, asio::buffer(buffer.get() + dataconsumed, bytestoread),
-                                 [size, extradata, socket, buffer](const std::error_code &ec, size_t) {
-                                     if (!ec) {
-                                         UnMaskMessage(size, buffer.get(), isServer);
-                                         auto tempsize = size - AdditionalBodyBytesToRead(isServer);
-                                         return ProcessControlMessage<isServer>(socket, buffer, tempsize, extradata);
-                                     }
-                                     else {
-                                         return sendclosemessage<isServer>(socket, 1002, "ReadBody Error " + ec.message());
-                                     }
-                                 });
-            }
-            else {
-                std::shared_ptr<unsigned char> ptr;
-                return ProcessControlMessage<isServer>(socket, ptr, 0, extradata);
-            }
+            // control frames are small enough to be read into the socket itself
+            ReadInto(socket, socket->ControlBuffer, size, extradata, [size, extradata, socket](const std::error_code &ec) {
+                if (!ec) {
+                    if (isServer) {
+                        ApplyMask(socket->ControlBuffer, socket->ControlBuffer, size, getMaskKey(socket->ReceiveHeader));
+                    }
+                    return ProcessControlMessage<isServer>(socket, socket->ControlBuffer, size, extradata);
+                }
+                else {
+                    return sendclosemessage<isServer>(socket, 1002, "ReadBody Error " + ec.message());
+                }
+            });
         }
 
         else if (opcode == OpCode::TEXT || opcode == OpCode::BINARY || opcode == OpCode::CONTINUATION) {
+            if (socket->Parent->onMessageChunk) {
+                return ReadStreamFrame<isServer>(socket, size, extradata);
+            }
             auto addedsize = socket->ReceiveBufferSize + size;
             if (addedsize > std::numeric_limits<std::size_t>::max()) {
                 SL_WS_LITE_LOG(Logging_Levels::ERROR_log_level, "payload exceeds memory on system!!! ");
@@ -456,27 +1024,25 @@ namespace WS_LITE {
             }
 
             if (size > 0) {
-                socket->ReceiveBuffer = static_cast<unsigned char *>(realloc(socket->ReceiveBuffer, socket->ReceiveBufferSize));
-                if (!socket->ReceiveBuffer) {
+                if (!socket->ReserveReceiveBuffer(socket->ReceiveBufferSize)) {
                     SL_WS_LITE_LOG(Logging_Levels::ERROR_log_level, "MEMORY ALLOCATION ERROR!!! Tried to realloc " << socket->ReceiveBufferSize);
                     return sendclosemessage<isServer>(socket, 1009, "Payload exceeded MaxPayload size");
                 }
 
-                auto bytestoread = size;
-                auto dataconsumed = ReadFromExtraData(socket->ReceiveBuffer + socket->ReceiveBufferSize - size, bytestoread, extradata);
-                bytestoread -= dataconsumed;
-                asio::async_read(socket->Socket, asio::buffer(socket->ReceiveBuffer + socket->ReceiveBufferSize - size + dataconsumed, bytestoread),
-                                 [size, extradata, socket](const std::error_code &ec, size_t) {
-                                     if (!ec) {
-                                         auto buffer = socket->ReceiveBuffer + socket->ReceiveBufferSize - size;
-                                         UnMaskMessage(size, buffer, isServer);
-                                         socket->ReceiveBufferSize -= AdditionalBodyBytesToRead(isServer);
-                                         return ProcessMessage<isServer>(socket, extradata);
-                                     }
-                                     else {
-                                         return sendclosemessage<isServer>(socket, 1002, "ReadBody Error " + ec.message());
-                                     }
-                                 });
+                ReadInto(socket, socket->ReceiveBuffer + socket->ReceiveBufferSize - size, size, extradata,
+                         [size, extradata, socket](const std::error_code &ec) {
+                             if (!ec) {
+                                 if (isServer) {
+                                     // the mask is kept in the header, so the payload is unmasked where it lies
+                                     auto buffer = socket->ReceiveBuffer + socket->ReceiveBufferSize - size;
+                                     ApplyMask(buffer, buffer, size, getMaskKey(socket->ReceiveHeader));
+                                 }
+                                 return ProcessMessage<isServer>(socket, extradata);
+                             }
+                             else {
+                                 return sendclosemessage<isServer>(socket, 1002, "ReadBody Error " + ec.message());
+                             }
+                         });
             }
             else {
                 return ProcessMessage<isServer>(socket, extradata);
@@ -490,55 +1056,44 @@ namespace WS_LITE {
     template <bool isServer, class SOCKETTYPE> void ReadHeaderNext(const SOCKETTYPE &socket, const std::shared_ptr<asio::streambuf> &extradata)
     {
         readexpire_from_now<isServer>(socket, socket->Parent->ReadTimeout);
-        size_t bytestoread = 2;
-        auto dataconsumed = ReadFromExtraData(socket->ReceiveHeader, bytestoread, extradata);
-        bytestoread -= dataconsumed;
-
-        asio::async_read(
-            socket->Socket, asio::buffer(socket->ReceiveHeader + dataconsumed, bytestoread), [socket, extradata](const std::error_code &ec, size_t) {
-                if (!ec) {
-
-                    size_t bytestoread = getpayloadLength1(socket->ReceiveHeader);
-                    switch (bytestoread) {
-                    case 126:
-                        bytestoread = 2;
-                        break;
-                    case 127:
-                        bytestoread = 8;
-                        break;
-                    default:
-                        bytestoread = 0;
-                    }
-                    if (bytestoread > 1) {
-                        auto dataconsumed = ReadFromExtraData(socket->ReceiveHeader + 2, bytestoread, extradata);
-                        bytestoread -= dataconsumed;
-
-                        asio::async_read(socket->Socket, asio::buffer(socket->ReceiveHeader + 2 + dataconsumed, bytestoread),
-                                         [socket, extradata](const std::error_code &ec, size_t) {
-                                             if (!ec) {
-                                                 ReadBody<isServer>(socket, extradata);
-                                             }
-                                             else {
-                                                 return sendclosemessage<isServer>(socket, 1002, "readheader ExtendedPayloadlen " + ec.message());
-                                             }
-                                         });
-                    }
-                    else {
-                        ReadBody<isServer>(socket, extradata);
-                    }
+        ReadInto(socket, socket->ReceiveHeader, 2, extradata, [socket, extradata](const std::error_code &ec) {
+            if (!ec) {
+                // the extended length and the mask key
+                auto bytestoread = getExtendedHeaderLength(socket->ReceiveHeader);
+                if (bytestoread > 0) {
+                    ReadInto(socket, socket->ReceiveHeader + 2, bytestoread, extradata, [socket, extradata](const std::error_code &ec) {
+                        if (!ec) {
+                            ReadBody<isServer>(socket, extradata);
+                        }
+                        else {
+                            return sendclosemessage<isServer>(socket, 1002, "readheader ExtendedPayloadlen " + ec.message());
+                        }
+                    });
                 }
                 else {
-                    return sendclosemessage<isServer>(socket, 1002, "WebSocket ReadHeader failed " + ec.message());
+                    ReadBody<isServer>(socket, extradata);
                 }
-            });
+            }
+            else {
+                return sendclosemessage<isServer>(socket, 1002, "WebSocket ReadHeader failed " + ec.message());
+            }
+        });
     }
     template <bool isServer, class SOCKETTYPE> void ReadHeaderStart(const SOCKETTYPE &socket, const std::shared_ptr<asio::streambuf> &extradata)
     {
-        free(socket->ReceiveBuffer);
-        socket->ReceiveBuffer = nullptr;
         socket->ReceiveBufferSize = 0;
+        if (socket->ReceiveBufferCapacity > MAX_RETAINED_STAGING_SIZE) {
+            // dont hold on to the memory of an unusually large message for the rest of the connection
+            socket->ReleaseReceiveBuffer();
+        }
         socket->LastOpCode = OpCode::INVALID;
         socket->FrameCompressed = false;
+        socket->StreamReceived = 0;
+        socket->StreamDelivered = 0;
+        socket->StreamUtf8.reset();
+        if (socket->InflateNoContextTakeover) {
+            socket->Inflater.reset();
+        }
         ReadHeaderNext<isServer>(socket, extradata);
     }
 
@@ -554,6 +1109,46 @@ namespace WS_LITE {
         virtual std::chrono::seconds get_ReadTimeout() override;
         virtual void set_WriteTimeout(std::chrono::seconds seconds) override;
         virtual std::chrono::seconds get_WriteTimeout() override;
+        virtual void set_MaxFlushBytes(size_t bytes) override;
+        virtual size_t get_MaxFlushBytes() override;
+        virtual void set_MaxFlushBuffers(size_t count) override;
+        virtual size_t get_MaxFlushBuffers() override;
+        virtual void set_MaxFrameSize(size_t bytes) override;
+        virtual size_t get_MaxFrameSize() override;
+        virtual HubStatistics get_Statistics() override;
+        virtual void subscribe(const std::shared_ptr<IWebSocket> &socket, const std::string &topic) override;
+        virtual void unsubscribe(const std::shared_ptr<IWebSocket> &socket, const std::string &topic) override;
+        virtual void publish(const std::string &topic, const std::shared_ptr<PreparedMessage> &msg) override;
+        virtual void set_MaxPublishBacklog(size_t bytes) override;
+        virtual size_t get_MaxPublishBacklog() override;
+        virtual void set_MaxQueuedBytes(size_t bytes) override;
+        virtual size_t get_MaxQueuedBytes() override;
+        virtual void set_MaxQueuedMessages(size_t count) override;
+        virtual size_t get_MaxQueuedMessages() override;
+        virtual void set_OverflowPolicy(OverflowPolicy policy) override;
+        virtual OverflowPolicy get_OverflowPolicy() override;
+        virtual void set_HighWatermark(size_t bytes) override;
+        virtual size_t get_HighWatermark() override;
+        virtual void set_LowWatermark(size_t bytes) override;
+        virtual size_t get_LowWatermark() override;
+        virtual void set_CompressionLevel(int level) override;
+        virtual int get_CompressionLevel() override;
+        virtual void set_CompressionMemLevel(int memlevel) override;
+        virtual int get_CompressionMemLevel() override;
+        virtual void set_CompressionWindowBits(int bits) override;
+        virtual int get_CompressionWindowBits() override;
+        virtual void set_DecompressionWindowBits(int bits) override;
+        virtual int get_DecompressionWindowBits() override;
+        virtual void set_CompressionNoContextTakeover(bool notakeover) override;
+        virtual bool get_CompressionNoContextTakeover() override;
+        virtual void set_DecompressionNoContextTakeover(bool notakeover) override;
+        virtual bool get_DecompressionNoContextTakeover() override;
+        virtual void set_InflateMemoryBudget(size_t bytes) override;
+        virtual size_t get_InflateMemoryBudget() override;
+        virtual void set_CompressionThreshold(size_t bytes) override;
+        virtual size_t get_CompressionThreshold() override;
+        virtual void set_CompressionCpuBudget(std::chrono::microseconds budget) override;
+        virtual std::chrono::microseconds get_CompressionCpuBudget() override;
     };
     class WSListener final : public IWSHub {
         std::shared_ptr<HubContext> Impl_;
@@ -567,6 +1162,46 @@ namespace WS_LITE {
         virtual std::chrono::seconds get_ReadTimeout() override;
         virtual void set_WriteTimeout(std::chrono::seconds seconds) override;
         virtual std::chrono::seconds get_WriteTimeout() override;
+        virtual void set_MaxFlushBytes(size_t bytes) override;
+        virtual size_t get_MaxFlushBytes() override;
+        virtual void set_MaxFlushBuffers(size_t count) override;
+        virtual size_t get_MaxFlushBuffers() override;
+        virtual void set_MaxFrameSize(size_t bytes) override;
+        virtual size_t get_MaxFrameSize() override;
+        virtual HubStatistics get_Statistics() override;
+        virtual void subscribe(const std::shared_ptr<IWebSocket> &socket, const std::string &topic) override;
+        virtual void unsubscribe(const std::shared_ptr<IWebSocket> &socket, const std::string &topic) override;
+        virtual void publish(const std::string &topic, const std::shared_ptr<PreparedMessage> &msg) override;
+        virtual void set_MaxPublishBacklog(size_t bytes) override;
+        virtual size_t get_MaxPublishBacklog() override;
+        virtual void set_MaxQueuedBytes(size_t bytes) override;
+        virtual size_t get_MaxQueuedBytes() override;
+        virtual void set_MaxQueuedMessages(size_t count) override;
+        virtual size_t get_MaxQueuedMessages() override;
+        virtual void set_OverflowPolicy(OverflowPolicy policy) override;
+        virtual OverflowPolicy get_OverflowPolicy() override;
+        virtual void set_HighWatermark(size_t bytes) override;
+        virtual size_t get_HighWatermark() override;
+        virtual void set_LowWatermark(size_t bytes) override;
+        virtual size_t get_LowWatermark() override;
+        virtual void set_CompressionLevel(int level) override;
+        virtual int get_CompressionLevel() override;
+        virtual void set_CompressionMemLevel(int memlevel) override;
+        virtual int get_CompressionMemLevel() override;
+        virtual void set_CompressionWindowBits(int bits) override;
+        virtual int get_CompressionWindowBits() override;
+        virtual void set_DecompressionWindowBits(int bits) override;
+        virtual int get_DecompressionWindowBits() override;
+        virtual void set_CompressionNoContextTakeover(bool notakeover) override;
+        virtual bool get_CompressionNoContextTakeover() override;
+        virtual void set_DecompressionNoContextTakeover(bool notakeover) override;
+        virtual bool get_DecompressionNoContextTakeover() override;
+        virtual void set_InflateMemoryBudget(size_t bytes) override;
+        virtual size_t get_InflateMemoryBudget() override;
+        virtual void set_CompressionThreshold(size_t bytes) override;
+        virtual size_t get_CompressionThreshold() override;
+        virtual void set_CompressionCpuBudget(std::chrono::microseconds budget) override;
+        virtual std::chrono::microseconds get_CompressionCpuBudget() override;
     };
 
     class WSListener_Configuration final : public IWSListener_Configuration {
@@ -579,12 +1214,16 @@ namespace WS_LITE {
         onConnection(const std::function<void(const std::shared_ptr<IWebSocket> &, const HttpHeader &)> &handle) override;
         virtual std::shared_ptr<IWSListener_Configuration>
         onMessage(const std::function<void(const std::shared_ptr<IWebSocket> &, const WSMessage &)> &handle) override;
+        virtual std::shared_ptr<IWSListener_Configuration> onMessageChunk(
+            const std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t, OpCode, bool)> &handle) override;
         virtual std::shared_ptr<IWSListener_Configuration>
         onDisconnection(const std::function<void(const std::shared_ptr<IWebSocket> &, unsigned short, const std::string &)> &handle) override;
         virtual std::shared_ptr<IWSListener_Configuration>
         onPing(const std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t)> &handle) override;
         virtual std::shared_ptr<IWSListener_Configuration>
         onPong(const std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t)> &handle) override;
+        virtual std::shared_ptr<IWSListener_Configuration> onDrain(const std::function<void(const std::shared_ptr<IWebSocket> &)> &handle) override;
+        virtual std::shared_ptr<IWSListener_Configuration> HandlerThreads(ThreadCount threadcount) override;
         virtual std::shared_ptr<IWSHub> listen(bool no_delay, bool reuse_address) override;
     };
 
@@ -598,12 +1237,16 @@ namespace WS_LITE {
         onConnection(const std::function<void(const std::shared_ptr<IWebSocket> &, const HttpHeader &)> &handle) override;
         virtual std::shared_ptr<IWSClient_Configuration>
         onMessage(const std::function<void(const std::shared_ptr<IWebSocket> &, const WSMessage &)> &handle) override;
+        virtual std::shared_ptr<IWSClient_Configuration> onMessageChunk(
+            const std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t, OpCode, bool)> &handle) override;
         virtual std::shared_ptr<IWSClient_Configuration>
         onDisconnection(const std::function<void(const std::shared_ptr<IWebSocket> &, unsigned short, const std::string &)> &handle) override;
         virtual std::shared_ptr<IWSClient_Configuration>
         onPing(const std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t)> &handle) override;
         virtual std::shared_ptr<IWSClient_Configuration>
         onPong(const std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t)> &handle) override;
+        virtual std::shared_ptr<IWSClient_Configuration> onDrain(const std::function<void(const std::shared_ptr<IWebSocket> &)> &handle) override;
+        virtual std::shared_ptr<IWSClient_Configuration> HandlerThreads(ThreadCount threadcount) override;
 
         virtual std::shared_ptr<IWSHub> connect(const std::string &host, PortNumber port, bool no_delay, const std::string &endpoint,
                                                 const std::unordered_map<std::string, std::string> &extraheaders) override;
@@ -0,0 +1,46 @@
+#pragma once
+#include "WS_Lite.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SL {
+namespace WS_LITE {
+    // runs handlers away from the io threads. Every worker has its own queue and takes from the others when it runs dry. Tasks posted by
+    // a worker go to its own queue, others are spread round robin
+    class WS_LITE_EXTERN WorkerPool {
+        struct Worker {
+            std::mutex Lock;
+            std::deque<std::function<void()>> Tasks;
+            std::thread Thread;
+        };
+        std::vector<std::unique_ptr<Worker>> Workers;
+        std::atomic<size_t> Queued{0};
+        std::atomic<size_t> NextWorker{0};
+        // workers waiting for a task, posts only take IdleLock when there is one
+        std::atomic<size_t> Sleeping{0};
+        std::mutex IdleLock;
+        std::condition_variable Idle;
+        std::atomic<bool> Stopping{false};
+
+        bool take(size_t self, std::function<void()> &task);
+        void run(size_t self);
+
+      public:
+        explicit WorkerPool(size_t threads);
+        ~WorkerPool();
+        WorkerPool(const WorkerPool &) = delete;
+        WorkerPool &operator=(const WorkerPool &) = delete;
+
+        void post(std::function<void()> task);
+        // runs what is queued, then joins the workers. Tasks posted afterwards are dropped
+        void stop();
+        size_t size() const { return Workers.size(); }
+    };
+} // namespace WS_LITE
+} // namespace SL
@@ -0,0 +1,226 @@
+#include "internal/BufferPool.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace SL {
+namespace WS_LITE {
+    namespace {
+        const size_t SIZECLASSES = 15; // 64 B .. 1 MB
+        // free blocks a thread keeps per class, half of them move to the depot when it has more. Large classes keep fewer blocks, so
+        // no class holds on to much more than CACHEDBYTES per thread
+        const size_t CACHEDBLOCKS = 64;
+        const size_t CACHEDBYTES = 256 * 1024;
+        // the depot of a class holds at most this many threads' worth of blocks, the rest go back to the heap
+        const size_t DEPOTCACHES = 4;
+        // the part of a cached large block that stays resident, the rest is handed back to the OS
+        const size_t RETAINEDLARGEBYTES = MAXPOOLBLOCKSIZE;
+        // in front of every large block, keeps the length of its mapping
+        const size_t LARGEHEADERSIZE = 64;
+
+        struct FreeBlock {
+            FreeBlock *Next;
+        };
+        struct FreeList {
+            FreeBlock *Head = nullptr;
+            size_t Count = 0;
+            void push(FreeBlock *b)
+            {
+                b->Next = Head;
+                Head = b;
+                Count += 1;
+            }
+            FreeBlock *pop()
+            {
+                auto b = Head;
+                Head = b->Next;
+                Count -= 1;
+                return b;
+            }
+            // moves up to count blocks to the front of other
+            void moveto(FreeList &other, size_t count)
+            {
+                while (Head && count-- > 0) {
+                    other.push(pop());
+                }
+            }
+        };
+        struct Depot {
+            std::mutex Lock;
+            FreeList Blocks;
+        };
+        // never destroyed, threads may return blocks while static objects are being torn down
+        Depot *Depots()
+        {
+            static auto depots = new Depot[SIZECLASSES];
+            return depots;
+        }
+
+#if defined(_WIN32)
+        size_t LargeLength(size_t size) { return size + LARGEHEADERSIZE; }
+        void *MapLarge(size_t length) { return ::operator new(length); }
+        void UnmapLarge(void *p, size_t) { ::operator delete(p); }
+        void TrimLarge(void *, size_t) {}
+#else
+        size_t LargeLength(size_t size)
+        {
+            static const auto pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            return (size + LARGEHEADERSIZE + pagesize - 1) / pagesize * pagesize;
+        }
+        void *MapLarge(size_t length)
+        {
+            auto p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            return p;
+        }
+        void UnmapLarge(void *p, size_t length) { munmap(p, length); }
+        // the pages past RETAINEDLARGEBYTES are given back, the mapping stays so the next large block does not need a new one
+        void TrimLarge(void *p, size_t length)
+        {
+            if (length > RETAINEDLARGEBYTES) {
+                madvise(static_cast<char *>(p) + RETAINEDLARGEBYTES, length - RETAINEDLARGEBYTES, MADV_DONTNEED);
+            }
+        }
+#endif
+        size_t &MappedLength(void *mapping) { return *static_cast<size_t *>(mapping); }
+
+        size_t CachedBlocks(size_t c) { return std::min(CACHEDBLOCKS, std::max<size_t>(2, CACHEDBYTES / (MINPOOLBLOCKSIZE << c))); }
+        // moves count blocks of class c from blocks to the depot, and frees those it has no room for
+        void ReleaseBlocks(FreeList &blocks, size_t c, size_t count)
+        {
+            auto &depot = Depots()[c];
+            {
+                std::lock_guard<std::mutex> lock(depot.Lock);
+                auto limit = DEPOTCACHES * CachedBlocks(c);
+                auto room = depot.Blocks.Count < limit ? limit - depot.Blocks.Count : 0;
+                auto moved = std::min(count, room);
+                blocks.moveto(depot.Blocks, moved);
+                count -= moved;
+            }
+            while (blocks.Head && count-- > 0) {
+                ::operator delete(blocks.pop());
+            }
+        }
+
+        struct ThreadCache {
+            FreeList Blocks[SIZECLASSES];
+            // the last large block freed on this thread, or null
+            void *Large = nullptr;
+            ~ThreadCache()
+            {
+                for (size_t c = 0; c < SIZECLASSES; c++) {
+                    ReleaseBlocks(Blocks[c], c, Blocks[c].Count);
+                }
+                if (Large) {
+                    UnmapLarge(Large, MappedLength(Large));
+                }
+            }
+        };
+        thread_local ThreadCache Cache;
+
+        size_t SizeClass(size_t size)
+        {
+            size_t c = 0;
+            for (auto blocksize = MINPOOLBLOCKSIZE; blocksize < size; blocksize <<= 1) {
+                c += 1;
+            }
+            return c;
+        }
+
+        void *AllocateLarge(size_t size)
+        {
+            auto length = LargeLength(size);
+            auto mapping = Cache.Large;
+            if (mapping && MappedLength(mapping) >= length) {
+                Cache.Large = nullptr;
+            }
+            else {
+                mapping = MapLarge(length);
+                MappedLength(mapping) = length;
+            }
+            return static_cast<char *>(mapping) + LARGEHEADERSIZE;
+        }
+        void DeallocateLarge(void *p)
+        {
+            auto mapping = static_cast<char *>(p) - LARGEHEADERSIZE;
+            auto length = MappedLength(mapping);
+            // keep the bigger of the two, so a thread that receives large messages settles on one mapping
+            if (Cache.Large && MappedLength(Cache.Large) >= length) {
+                return UnmapLarge(mapping, length);
+            }
+            if (Cache.Large) {
+                UnmapLarge(Cache.Large, MappedLength(Cache.Large));
+            }
+            TrimLarge(mapping, length);
+            Cache.Large = mapping;
+        }
+    } // namespace
+
+    void *PoolAllocate(size_t size)
+    {
+        if (size > MAXPOOLBLOCKSIZE) {
+            return AllocateLarge(size);
+        }
+        auto c = SizeClass(size);
+        auto &blocks = Cache.Blocks[c];
+        if (!blocks.Head) {
+            auto &depot = Depots()[c];
+            std::lock_guard<std::mutex> lock(depot.Lock);
+            depot.Blocks.moveto(blocks, CachedBlocks(c) / 2);
+        }
+        if (!blocks.Head) {
+            return ::operator new(MINPOOLBLOCKSIZE << c);
+        }
+        return blocks.pop();
+    }
+    void PoolDeallocate(void *p, size_t size)
+    {
+        if (size > MAXPOOLBLOCKSIZE) {
+            return DeallocateLarge(p);
+        }
+        auto c = SizeClass(size);
+        auto &blocks = Cache.Blocks[c];
+        blocks.push(static_cast<FreeBlock *>(p));
+        if (blocks.Count > CachedBlocks(c)) {
+            ReleaseBlocks(blocks, c, CachedBlocks(c) / 2);
+        }
+    }
+    void *PoolReallocate(void *p, size_t oldsize, size_t newsize)
+    {
+        if (p && PoolBlockSize(oldsize) >= newsize) {
+            return p;
+        }
+        auto block = PoolAllocate(newsize);
+        if (p) {
+            memcpy(block, p, std::min(oldsize, newsize));
+            PoolDeallocate(p, oldsize);
+        }
+        return block;
+    }
+    size_t PoolBlockSize(size_t size)
+    {
+        if (size > MAXPOOLBLOCKSIZE) {
+            return LargeLength(size) - LARGEHEADERSIZE;
+        }
+        return MINPOOLBLOCKSIZE << SizeClass(size);
+    }
+    std::shared_ptr<unsigned char> AllocateBuffer(size_t size) { return AdoptBuffer(static_cast<unsigned char *>(PoolAllocate(size)), size); }
+    std::shared_ptr<unsigned char> AdoptBuffer(unsigned char *p, size_t size)
+    {
+        struct PoolDeleter {
+            size_t Size;
+            void operator()(unsigned char *p) const { PoolDeallocate(p, Size); }
+        };
+        return std::shared_ptr<unsigned char>(p, PoolDeleter{size}, PoolAllocator<unsigned char>());
+    }
+
+} // namespace WS_LITE
+} // namespace SL
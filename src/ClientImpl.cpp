@@ -12,6 +12,22 @@
 namespace SL {
 namespace WS_LITE {
 
+    // the server may only answer with permessage-deflate, and only when it was offered
+    template <class SOCKETTYPE> bool ReadExtensionResponse(const SOCKETTYPE &socket, const HttpHeader &header)
+    {
+        auto response = std::find_if(std::begin(header.Values), std::end(header.Values),
+                                     [](const HeaderKeyValue &k) { return k.Key == "Sec-WebSocket-Extensions"; });
+        if (response == std::end(header.Values)) {
+            return true;
+        }
+        DeflateParameters agreed;
+        if (socket->Parent->ExtensionOptions_ == ExtensionOptions::NO_OPTIONS ||
+            !ReadDeflateResponse(response->Value, socket->Parent->DeflateSettings_, agreed)) {
+            return false;
+        }
+        socket->UseDeflate(agreed);
+        return true;
+    }
     template <class SOCKETTYPE>
     void ConnectHandshake(const std::shared_ptr<HubContext> self, SOCKETTYPE &socket, const std::string &host, const std::string &endpoint,
                           const std::unordered_map<std::string, std::string> &extraheaders)
@@ -27,11 +43,7 @@ namespace WS_LITE {
         // Make random 16-byte nonce
         std::string nonce;
         nonce.resize(16);
-        std::uniform_int_distribution<unsigned int> dist(0, 255);
-        std::random_device rd;
-        for (int c = 0; c < 16; c++) {
-            nonce[c] = static_cast<unsigned char>(dist(rd));
-        }
+        socket->Parent->Random.get(reinterpret_cast<unsigned char *>(&nonce[0]), nonce.size());
 
         auto nonce_base64 = Base64encode(nonce);
         request << "Sec-WebSocket-Key:" << nonce_base64 << "\r\n";
@@ -39,8 +51,9 @@ namespace WS_LITE {
         for (auto &h : extraheaders) {
             request << h.first << ":" << h.second << "\r\n";
         }
-        //  request << "" << HTTP_ENDLINE;
-        //  request << HTTP_SECWEBSOCKETEXTENSIONS << HTTP_KEYVALUEDELIM << PERMESSAGEDEFLATE << HTTP_ENDLINE;
+        if (socket->Parent->ExtensionOptions_ != ExtensionOptions::NO_OPTIONS) {
+            request << "Sec-WebSocket-Extensions: " << CreateDeflateOffer(socket->Parent->OfferedDeflateSettings()) << "\r\n";
+        }
         request << "\r\n";
 
         auto accept_sha1 = SHA1(nonce_base64 + ws_magic_string);
@@ -66,7 +79,7 @@ namespace WS_LITE {
                                                    if (sockey == std::end(header.Values)) {
                                                        return;
                                                    }
-                                                   if (Base64decode(sockey->Value) == accept_sha1) {
+                                                   if (Base64decode(sockey->Value) == accept_sha1 && ReadExtensionResponse(socket, header)) {
 
                                                        SL_WS_LITE_LOG(Logging_Levels::INFO_log_level, "Connected ");
 
@@ -75,6 +88,7 @@ namespace WS_LITE {
                                                        if (socket->Parent->onConnection) {
                                                            socket->Parent->onConnection(socket, header);
                                                        }
+                                                       read_buffer->consume(bytes_transferred); // only frames remain after the handshake
                                                        ReadHeaderStart<false>(socket, read_buffer);
                                                    }
                                                    else {
@@ -197,6 +211,206 @@ namespace WS_LITE {
     {
         return Impl_->ThreadContexts.empty() ? 1024 * 1024 * 20 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxPayload;
     }
+    void WSClient::set_MaxFlushBytes(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->MaxFlushBytes = bytes;
+        }
+    }
+    size_t WSClient::get_MaxFlushBytes()
+    {
+        return Impl_->ThreadContexts.empty() ? 1024 * 256 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxFlushBytes;
+    }
+    void WSClient::set_MaxFlushBuffers(size_t count)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->MaxFlushBuffers = count;
+        }
+    }
+    size_t WSClient::get_MaxFlushBuffers()
+    {
+        return Impl_->ThreadContexts.empty() ? 64 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxFlushBuffers;
+    }
+    void WSClient::set_MaxFrameSize(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->MaxFrameSize = bytes;
+        }
+    }
+    size_t WSClient::get_MaxFrameSize()
+    {
+        return Impl_->ThreadContexts.empty() ? 0 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxFrameSize;
+    }
+    HubStatistics WSClient::get_Statistics() { return Impl_->get_Statistics(); }
+    void WSClient::subscribe(const std::shared_ptr<IWebSocket> &socket, const std::string &topic)
+    {
+        if (Impl_->TLSEnabled) {
+            SL::WS_LITE::subscribe<false, asio::ssl::stream<asio::ip::tcp::socket>>(socket, topic);
+        }
+        else {
+            SL::WS_LITE::subscribe<false, asio::ip::tcp::socket>(socket, topic);
+        }
+    }
+    void WSClient::unsubscribe(const std::shared_ptr<IWebSocket> &socket, const std::string &topic)
+    {
+        if (Impl_->TLSEnabled) {
+            SL::WS_LITE::unsubscribe<false, asio::ssl::stream<asio::ip::tcp::socket>>(socket, topic);
+        }
+        else {
+            SL::WS_LITE::unsubscribe<false, asio::ip::tcp::socket>(socket, topic);
+        }
+    }
+    void WSClient::publish(const std::string &topic, const std::shared_ptr<PreparedMessage> &msg) { Impl_->publish(topic, msg); }
+    void WSClient::set_MaxPublishBacklog(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->MaxPublishBacklog = bytes;
+        }
+    }
+    size_t WSClient::get_MaxPublishBacklog()
+    {
+        return Impl_->ThreadContexts.empty() ? 0 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxPublishBacklog;
+    }
+    void WSClient::set_MaxQueuedBytes(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->MaxQueuedBytes = bytes;
+        }
+    }
+    size_t WSClient::get_MaxQueuedBytes()
+    {
+        return Impl_->ThreadContexts.empty() ? 0 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxQueuedBytes;
+    }
+    void WSClient::set_MaxQueuedMessages(size_t count)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->MaxQueuedMessages = count;
+        }
+    }
+    size_t WSClient::get_MaxQueuedMessages()
+    {
+        return Impl_->ThreadContexts.empty() ? 0 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxQueuedMessages;
+    }
+    void WSClient::set_OverflowPolicy(OverflowPolicy policy)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->OverflowPolicy_ = policy;
+        }
+    }
+    OverflowPolicy WSClient::get_OverflowPolicy()
+    {
+        return Impl_->ThreadContexts.empty() ? OverflowPolicy::REJECT : Impl_->ThreadContexts.front()->WebSocketContext_->OverflowPolicy_;
+    }
+    void WSClient::set_HighWatermark(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->HighWatermark = bytes;
+        }
+    }
+    size_t WSClient::get_HighWatermark()
+    {
+        return Impl_->ThreadContexts.empty() ? 1024 * 1024 : Impl_->ThreadContexts.front()->WebSocketContext_->HighWatermark;
+    }
+    void WSClient::set_LowWatermark(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->LowWatermark = bytes;
+        }
+    }
+    size_t WSClient::get_LowWatermark()
+    {
+        return Impl_->ThreadContexts.empty() ? 1024 * 256 : Impl_->ThreadContexts.front()->WebSocketContext_->LowWatermark;
+    }
+    void WSClient::set_CompressionLevel(int level)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->CompressionLevel = level;
+        }
+    }
+    int WSClient::get_CompressionLevel()
+    {
+        return Impl_->ThreadContexts.empty() ? Z_DEFAULT_COMPRESSION : Impl_->ThreadContexts.front()->WebSocketContext_->CompressionLevel;
+    }
+    void WSClient::set_CompressionMemLevel(int memlevel)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->CompressionMemLevel = memlevel;
+        }
+    }
+    int WSClient::get_CompressionMemLevel()
+    {
+        return Impl_->ThreadContexts.empty() ? 8 : Impl_->ThreadContexts.front()->WebSocketContext_->CompressionMemLevel;
+    }
+    void WSClient::set_CompressionWindowBits(int bits)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->DeflateSettings_.CompressionWindowBits = bits;
+        }
+    }
+    int WSClient::get_CompressionWindowBits()
+    {
+        return Impl_->ThreadContexts.empty() ? 15 : Impl_->ThreadContexts.front()->WebSocketContext_->DeflateSettings_.CompressionWindowBits;
+    }
+    void WSClient::set_DecompressionWindowBits(int bits)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->DeflateSettings_.DecompressionWindowBits = bits;
+        }
+    }
+    int WSClient::get_DecompressionWindowBits()
+    {
+        return Impl_->ThreadContexts.empty() ? 15 : Impl_->ThreadContexts.front()->WebSocketContext_->DeflateSettings_.DecompressionWindowBits;
+    }
+    void WSClient::set_CompressionNoContextTakeover(bool notakeover)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->DeflateSettings_.CompressionNoContextTakeover = notakeover;
+        }
+    }
+    bool WSClient::get_CompressionNoContextTakeover()
+    {
+        return Impl_->ThreadContexts.empty() ? false : Impl_->ThreadContexts.front()->WebSocketContext_->DeflateSettings_.CompressionNoContextTakeover;
+    }
+    void WSClient::set_DecompressionNoContextTakeover(bool notakeover)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->DeflateSettings_.DecompressionNoContextTakeover = notakeover;
+        }
+    }
+    bool WSClient::get_DecompressionNoContextTakeover()
+    {
+        return Impl_->ThreadContexts.empty() ? false : Impl_->ThreadContexts.front()->WebSocketContext_->DeflateSettings_.DecompressionNoContextTakeover;
+    }
+    void WSClient::set_InflateMemoryBudget(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->InflateBudget_->Limit = bytes;
+        }
+    }
+    size_t WSClient::get_InflateMemoryBudget()
+    {
+        return Impl_->ThreadContexts.empty() ? 0 : Impl_->ThreadContexts.front()->WebSocketContext_->InflateBudget_->Limit.load();
+    }
+    void WSClient::set_CompressionThreshold(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->CompressionThreshold = bytes;
+        }
+    }
+    size_t WSClient::get_CompressionThreshold()
+    {
+        return Impl_->ThreadContexts.empty() ? 64 : Impl_->ThreadContexts.front()->WebSocketContext_->CompressionThreshold;
+    }
+    void WSClient::set_CompressionCpuBudget(std::chrono::microseconds budget)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->CompressionCpuBudget = budget;
+        }
+    }
+    std::chrono::microseconds WSClient::get_CompressionCpuBudget()
+    {
+        return Impl_->ThreadContexts.empty() ? std::chrono::microseconds(0) : Impl_->ThreadContexts.front()->WebSocketContext_->CompressionCpuBudget;
+    }
 
     std::shared_ptr<IWSClient_Configuration>
     WSClient_Configuration::onConnection(const std::function<void(const std::shared_ptr<IWebSocket> &, const HttpHeader &)> &handle)
@@ -216,6 +430,15 @@ namespace WS_LITE {
         }
         return std::make_shared<WSClient_Configuration>(Impl_);
     }
+    std::shared_ptr<IWSClient_Configuration> WSClient_Configuration::onMessageChunk(
+        const std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t, OpCode, bool)> &handle)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            assert(!t->WebSocketContext_->onMessageChunk);
+            t->WebSocketContext_->onMessageChunk = handle;
+        }
+        return std::make_shared<WSClient_Configuration>(Impl_);
+    }
     std::shared_ptr<IWSClient_Configuration> WSClient_Configuration::onDisconnection(
         const std::function<void(const std::shared_ptr<IWebSocket> &, unsigned short, const std::string &)> &handle)
     {
@@ -245,6 +468,24 @@ namespace WS_LITE {
         }
         return std::make_shared<WSClient_Configuration>(Impl_);
     }
+    std::shared_ptr<IWSClient_Configuration>
+    WSClient_Configuration::onDrain(const std::function<void(const std::shared_ptr<IWebSocket> &)> &handle)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            assert(!t->WebSocketContext_->onDrain);
+            t->WebSocketContext_->onDrain = handle;
+        }
+        return std::make_shared<WSClient_Configuration>(Impl_);
+    }
+    std::shared_ptr<IWSClient_Configuration> WSClient_Configuration::HandlerThreads(ThreadCount threadcount)
+    {
+        assert(!Impl_->Workers);
+        Impl_->Workers = std::make_shared<WorkerPool>(threadcount.value);
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->Workers = Impl_->Workers;
+        }
+        return std::make_shared<WSClient_Configuration>(Impl_);
+    }
     std::shared_ptr<IWSHub> WSClient_Configuration::connect(const std::string &host, PortNumber port, bool no_delay, const std::string &endpoint,
                                                             const std::unordered_map<std::string, std::string> &extraheaders)
     {
@@ -1 +1,107 @@
 #include "Extensions.h"
+#include <algorithm>
+
+namespace SL {
+namespace WS_LITE {
+    namespace {
+        bool ValidWindowBits(int bits) { return bits >= 8 && bits <= 15; }
+        int ClampWindowBits(int bits) { return std::min(std::max(bits, 8), 15); }
+    } // namespace
+
+    std::string CreateDeflateOffer(const DeflateSettings &settings)
+    {
+        auto compressionbits = ClampWindowBits(settings.CompressionWindowBits);
+        auto decompressionbits = ClampWindowBits(settings.DecompressionWindowBits);
+        // client_max_window_bits lets the server pick a smaller window for us, with a value it is a hint of what we use anyway
+        std::string offer = "permessage-deflate; client_max_window_bits";
+        if (compressionbits < 15) {
+            offer += "=" + std::to_string(compressionbits);
+        }
+        if (decompressionbits < 15) {
+            offer += "; server_max_window_bits=" + std::to_string(decompressionbits);
+        }
+        if (settings.DecompressionNoContextTakeover) {
+            offer += "; server_no_context_takeover";
+        }
+        if (settings.CompressionNoContextTakeover) {
+            offer += "; client_no_context_takeover";
+        }
+        return offer;
+    }
+
+    bool AcceptDeflateOffer(std::string_view offer, const DeflateSettings &settings, DeflateParameters &agreed, std::string &response)
+    {
+        // an offer with parameters that are unknown, repeated or out of range is declined (RFC 7692 section 5), the next one may still do
+        ExtensionsParser offered(offer.data(), offer.size());
+        // server_max_window_bits needs a value, client_max_window_bits may go without one
+        while (offered.perMessageDeflate && (!offered.valid || (offered.serverMaxWindowBits && !ValidWindowBits(offered.serverMaxWindowBits)) ||
+                                             (offered.clientMaxWindowBits > 1 && !ValidWindowBits(offered.clientMaxWindowBits)))) {
+            offered = ExtensionsParser(offered.next, static_cast<size_t>(offer.data() + offer.size() - offered.next));
+        }
+        if (!offered.perMessageDeflate) {
+            return false;
+        }
+        agreed = DeflateParameters();
+        agreed.ServerNoContextTakeover = offered.serverNoContextTakeover || settings.CompressionNoContextTakeover;
+        // a server may ask this of a client that did not offer it
+        agreed.ClientNoContextTakeover = offered.clientNoContextTakeover || settings.DecompressionNoContextTakeover;
+        agreed.ServerMaxWindowBits = ClampWindowBits(settings.CompressionWindowBits);
+        if (offered.serverMaxWindowBits) {
+            agreed.ServerMaxWindowBits = std::min(agreed.ServerMaxWindowBits, offered.serverMaxWindowBits);
+        }
+        // the client window can only be limited when the client said it can deal with that
+        if (offered.clientMaxWindowBits) {
+            agreed.ClientMaxWindowBits = ClampWindowBits(settings.DecompressionWindowBits);
+            if (offered.clientMaxWindowBits > 1) {
+                agreed.ClientMaxWindowBits = std::min(agreed.ClientMaxWindowBits, offered.clientMaxWindowBits);
+            }
+        }
+
+        response = "permessage-deflate";
+        if (agreed.ServerNoContextTakeover) {
+            response += "; server_no_context_takeover";
+        }
+        if (agreed.ClientNoContextTakeover) {
+            response += "; client_no_context_takeover";
+        }
+        if (offered.serverMaxWindowBits || agreed.ServerMaxWindowBits < 15) {
+            response += "; server_max_window_bits=" + std::to_string(agreed.ServerMaxWindowBits);
+        }
+        if (offered.clientMaxWindowBits && agreed.ClientMaxWindowBits < 15) {
+            response += "; client_max_window_bits=" + std::to_string(agreed.ClientMaxWindowBits);
+        }
+        return true;
+    }
+
+    bool ReadDeflateResponse(std::string_view response, const DeflateSettings &settings, DeflateParameters &agreed)
+    {
+        ExtensionsParser answered(response.data(), response.size());
+        if (!answered.perMessageDeflate || !answered.valid) {
+            return false;
+        }
+        // both have to carry a value in a response
+        if ((answered.serverMaxWindowBits && !ValidWindowBits(answered.serverMaxWindowBits)) ||
+            (answered.clientMaxWindowBits && !ValidWindowBits(answered.clientMaxWindowBits))) {
+            return false;
+        }
+        // the server has to go along with what we asked of it, or decline permessage-deflate altogether
+        auto decompressionbits = ClampWindowBits(settings.DecompressionWindowBits);
+        if (decompressionbits < 15 && (!answered.serverMaxWindowBits || answered.serverMaxWindowBits > decompressionbits)) {
+            return false;
+        }
+        if (settings.DecompressionNoContextTakeover && !answered.serverNoContextTakeover) {
+            return false;
+        }
+        agreed = DeflateParameters();
+        agreed.ServerNoContextTakeover = answered.serverNoContextTakeover;
+        agreed.ClientNoContextTakeover = answered.clientNoContextTakeover || settings.CompressionNoContextTakeover;
+        agreed.ServerMaxWindowBits = answered.serverMaxWindowBits ? answered.serverMaxWindowBits : 15;
+        agreed.ClientMaxWindowBits = ClampWindowBits(settings.CompressionWindowBits);
+        if (answered.clientMaxWindowBits) {
+            agreed.ClientMaxWindowBits = std::min(agreed.ClientMaxWindowBits, answered.clientMaxWindowBits);
+        }
+        return true;
+    }
+
+} // namespace WS_LITE
+} // namespace SL
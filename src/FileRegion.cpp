@@ -0,0 +1,127 @@
+#include "internal/FileRegion.h"
+#include "Logging.h"
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if WS_LITE_HAS_SENDFILE
+#include <sys/sendfile.h>
+#endif
+#include <cerrno>
+
+namespace SL {
+namespace WS_LITE {
+
+    FileDescriptor::~FileDescriptor()
+    {
+#if defined(_WIN32)
+        _close(Fd);
+#else
+        ::close(Fd);
+#endif
+    }
+
+    std::shared_ptr<FileDescriptor> DuplicateFile(int fd)
+    {
+#if defined(_WIN32)
+        auto copy = _dup(fd);
+#else
+        auto copy = ::dup(fd);
+#endif
+        if (copy < 0) {
+            return std::shared_ptr<FileDescriptor>();
+        }
+        return std::make_shared<FileDescriptor>(copy);
+    }
+
+    bool FileRegionInBounds(int fd, size_t offset, size_t length)
+    {
+#if defined(_WIN32)
+        struct _stat64 st;
+        if (_fstat64(fd, &st) != 0) {
+            return false;
+        }
+#else
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            return false;
+        }
+#endif
+        auto size = static_cast<size_t>(st.st_size);
+        return length > 0 && offset <= size && length <= size - offset;
+    }
+
+    std::shared_ptr<unsigned char> MapFileRegion(int fd, size_t offset, size_t length, unsigned char *&data)
+    {
+        data = nullptr;
+        if (length == 0) {
+            return std::shared_ptr<unsigned char>();
+        }
+#if defined(_WIN32)
+        auto buffer = std::shared_ptr<unsigned char>(new unsigned char[length], [](unsigned char *p) { delete[] p; });
+        if (_lseeki64(fd, static_cast<long long>(offset), SEEK_SET) < 0) {
+            return std::shared_ptr<unsigned char>();
+        }
+        size_t bytesread = 0;
+        while (bytesread < length) {
+            auto count = _read(fd, buffer.get() + bytesread, static_cast<unsigned int>(std::min<size_t>(length - bytesread, 1 << 30)));
+            if (count <= 0) {
+                return std::shared_ptr<unsigned char>();
+            }
+            bytesread += static_cast<size_t>(count);
+        }
+        data = buffer.get();
+        return buffer;
+#else
+        // mappings have to start on a page boundary
+        static const size_t pagesize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        auto alignedoffset = offset - offset % pagesize;
+        auto mappedlength = length + (offset - alignedoffset);
+        auto p = mmap(nullptr, mappedlength, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(alignedoffset));
+        if (p == MAP_FAILED) {
+            return std::shared_ptr<unsigned char>();
+        }
+        auto start = static_cast<unsigned char *>(p);
+        data = start + (offset - alignedoffset);
+        return std::shared_ptr<unsigned char>(start, [mappedlength](unsigned char *m) { munmap(m, mappedlength); });
+#endif
+    }
+
+    size_t SendFileRegion(int socket, int fd, size_t offset, size_t length, std::error_code &ec)
+    {
+#if WS_LITE_HAS_SENDFILE
+        auto off = static_cast<off_t>(offset);
+        for (;;) {
+            auto sent = ::sendfile(socket, fd, &off, length);
+            if (sent >= 0) {
+                if (sent == 0 && length > 0) {
+                    ec = std::make_error_code(std::errc::io_error); // the file is shorter than the frame header says
+                }
+                return static_cast<size_t>(sent);
+            }
+            if (errno != EINTR) {
+                ec = std::error_code(errno, std::generic_category());
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    ec = std::make_error_code(std::errc::operation_would_block);
+                }
+                return 0;
+            }
+        }
+#else
+        UNUSED(socket);
+        UNUSED(fd);
+        UNUSED(offset);
+        UNUSED(length);
+        ec = std::make_error_code(std::errc::operation_not_supported);
+        return 0;
+#endif
+    }
+
+} // namespace WS_LITE
+} // namespace SL
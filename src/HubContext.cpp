@@ -16,12 +16,21 @@ namespace WS_LITE {
         for (auto i = 0; i < threadcount.value; i++) {
             ThreadContexts.push_back(std::make_shared<ThreadContext>(m));
         }
+        ShareInflateBudget();
     }
     HubContext::HubContext(ThreadCount threadcount)
     {
         for (auto i = 0; i < threadcount.value; i++) {
             ThreadContexts.push_back(std::make_shared<ThreadContext>());
         }
+        ShareInflateBudget();
+    }
+    void HubContext::ShareInflateBudget()
+    {
+        auto budget = std::make_shared<InflateBudget>();
+        for (auto &t : ThreadContexts) {
+            t->WebSocketContext_->InflateBudget_ = budget;
+        }
     }
     HubContext::~HubContext()
     {
@@ -41,8 +50,45 @@ namespace WS_LITE {
                 }
             }
         }
+        if (Workers) {
+            Workers->stop();
+        }
         ThreadContexts.clear();
     }
+    HubStatistics HubContext::get_Statistics() const
+    {
+        HubStatistics stats;
+        for (auto &t : ThreadContexts) {
+            stats.Flushes += t->WebSocketContext_->Flushes.load(std::memory_order_relaxed);
+            stats.FramesFlushed += t->WebSocketContext_->FramesFlushed.load(std::memory_order_relaxed);
+            stats.Reads += t->WebSocketContext_->Reads.load(std::memory_order_relaxed);
+            stats.FramesReceived += t->WebSocketContext_->FramesReceived.load(std::memory_order_relaxed);
+            stats.PublishDelivered += t->WebSocketContext_->PublishDelivered.load(std::memory_order_relaxed);
+            stats.PublishSkipped += t->WebSocketContext_->PublishSkipped.load(std::memory_order_relaxed);
+            stats.SendsRejected += t->WebSocketContext_->SendsRejected.load(std::memory_order_relaxed);
+            stats.MessagesDropped += t->WebSocketContext_->MessagesDropped.load(std::memory_order_relaxed);
+            stats.OverflowCloses += t->WebSocketContext_->OverflowCloses.load(std::memory_order_relaxed);
+            stats.MessagesCompressed += t->WebSocketContext_->MessagesCompressed.load(std::memory_order_relaxed);
+            stats.CompressionBytesIn += t->WebSocketContext_->CompressionBytesIn.load(std::memory_order_relaxed);
+            stats.CompressionBytesOut += t->WebSocketContext_->CompressionBytesOut.load(std::memory_order_relaxed);
+            stats.CompressionMicroseconds += t->WebSocketContext_->CompressionMicroseconds.load(std::memory_order_relaxed);
+            stats.CompressionsSkipped += t->WebSocketContext_->CompressionsSkipped.load(std::memory_order_relaxed);
+        }
+        if (!ThreadContexts.empty()) {
+            auto &budget = ThreadContexts.front()->WebSocketContext_->InflateBudget_;
+            stats.InflateMemory = budget->Used.load(std::memory_order_relaxed);
+            stats.InflateEvictions = budget->Evictions.load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+    void HubContext::publish(const std::string &topic, const std::shared_ptr<PreparedMessage> &msg)
+    {
+        // every thread delivers to its own subscribers
+        for (auto &t : ThreadContexts) {
+            auto context = t->WebSocketContext_;
+            t->io_service.post([context, topic, msg]() { context->Publish(topic, msg); });
+        }
+    }
 
     struct DelayedInfo {
         ThreadCount threadcount;
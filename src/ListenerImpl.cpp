@@ -33,9 +33,16 @@ namespace WS_LITE {
                     if (auto[response, parsesuccess] = CreateHandShake(handshakecontainer->Header); parsesuccess) {
                         handshakecontainer->Write = response;
                         if (socket->Parent->ExtensionOptions_ != ExtensionOptions::NO_OPTIONS) {
-                            auto[headerresponse, agreedcompression] = CreateExtensionOffer(handshakecontainer->Header);
-                            handshakecontainer->Write += headerresponse;
-                            socket->ExtensionOption = agreedcompression;
+                            auto &values = handshakecontainer->Header.Values;
+                            auto offer = std::find_if(std::begin(values), std::end(values),
+                                                      [](const HeaderKeyValue &k) { return k.Key == "Sec-WebSocket-Extensions"; });
+                            DeflateParameters agreed;
+                            std::string extensionresponse;
+                            if (offer != std::end(values) &&
+                                AcceptDeflateOffer(offer->Value, socket->Parent->OfferedDeflateSettings(), agreed, extensionresponse)) {
+                                handshakecontainer->Write += "Sec-WebSocket-Extensions: " + extensionresponse + "\r\n";
+                                socket->UseDeflate(agreed);
+                            }
                         }
                         handshakecontainer->Write += "\r\n";
 
@@ -149,6 +156,206 @@ namespace WS_LITE {
     {
         return Impl_->ThreadContexts.empty() ? 1024 * 1024 * 20 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxPayload;
     }
+    void WSListener::set_MaxFlushBytes(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->MaxFlushBytes = bytes;
+        }
+    }
+    size_t WSListener::get_MaxFlushBytes()
+    {
+        return Impl_->ThreadContexts.empty() ? 1024 * 256 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxFlushBytes;
+    }
+    void WSListener::set_MaxFlushBuffers(size_t count)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->MaxFlushBuffers = count;
+        }
+    }
+    size_t WSListener::get_MaxFlushBuffers()
+    {
+        return Impl_->ThreadContexts.empty() ? 64 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxFlushBuffers;
+    }
+    void WSListener::set_MaxFrameSize(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->MaxFrameSize = bytes;
+        }
+    }
+    size_t WSListener::get_MaxFrameSize()
+    {
+        return Impl_->ThreadContexts.empty() ? 0 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxFrameSize;
+    }
+    HubStatistics WSListener::get_Statistics() { return Impl_->get_Statistics(); }
+    void WSListener::subscribe(const std::shared_ptr<IWebSocket> &socket, const std::string &topic)
+    {
+        if (Impl_->TLSEnabled) {
+            SL::WS_LITE::subscribe<true, asio::ssl::stream<asio::ip::tcp::socket>>(socket, topic);
+        }
+        else {
+            SL::WS_LITE::subscribe<true, asio::ip::tcp::socket>(socket, topic);
+        }
+    }
+    void WSListener::unsubscribe(const std::shared_ptr<IWebSocket> &socket, const std::string &topic)
+    {
+        if (Impl_->TLSEnabled) {
+            SL::WS_LITE::unsubscribe<true, asio::ssl::stream<asio::ip::tcp::socket>>(socket, topic);
+        }
+        else {
+            SL::WS_LITE::unsubscribe<true, asio::ip::tcp::socket>(socket, topic);
+        }
+    }
+    void WSListener::publish(const std::string &topic, const std::shared_ptr<PreparedMessage> &msg) { Impl_->publish(topic, msg); }
+    void WSListener::set_MaxPublishBacklog(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->MaxPublishBacklog = bytes;
+        }
+    }
+    size_t WSListener::get_MaxPublishBacklog()
+    {
+        return Impl_->ThreadContexts.empty() ? 0 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxPublishBacklog;
+    }
+    void WSListener::set_MaxQueuedBytes(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->MaxQueuedBytes = bytes;
+        }
+    }
+    size_t WSListener::get_MaxQueuedBytes()
+    {
+        return Impl_->ThreadContexts.empty() ? 0 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxQueuedBytes;
+    }
+    void WSListener::set_MaxQueuedMessages(size_t count)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->MaxQueuedMessages = count;
+        }
+    }
+    size_t WSListener::get_MaxQueuedMessages()
+    {
+        return Impl_->ThreadContexts.empty() ? 0 : Impl_->ThreadContexts.front()->WebSocketContext_->MaxQueuedMessages;
+    }
+    void WSListener::set_OverflowPolicy(OverflowPolicy policy)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->OverflowPolicy_ = policy;
+        }
+    }
+    OverflowPolicy WSListener::get_OverflowPolicy()
+    {
+        return Impl_->ThreadContexts.empty() ? OverflowPolicy::REJECT : Impl_->ThreadContexts.front()->WebSocketContext_->OverflowPolicy_;
+    }
+    void WSListener::set_HighWatermark(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->HighWatermark = bytes;
+        }
+    }
+    size_t WSListener::get_HighWatermark()
+    {
+        return Impl_->ThreadContexts.empty() ? 1024 * 1024 : Impl_->ThreadContexts.front()->WebSocketContext_->HighWatermark;
+    }
+    void WSListener::set_LowWatermark(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->LowWatermark = bytes;
+        }
+    }
+    size_t WSListener::get_LowWatermark()
+    {
+        return Impl_->ThreadContexts.empty() ? 1024 * 256 : Impl_->ThreadContexts.front()->WebSocketContext_->LowWatermark;
+    }
+    void WSListener::set_CompressionLevel(int level)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->CompressionLevel = level;
+        }
+    }
+    int WSListener::get_CompressionLevel()
+    {
+        return Impl_->ThreadContexts.empty() ? Z_DEFAULT_COMPRESSION : Impl_->ThreadContexts.front()->WebSocketContext_->CompressionLevel;
+    }
+    void WSListener::set_CompressionMemLevel(int memlevel)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->CompressionMemLevel = memlevel;
+        }
+    }
+    int WSListener::get_CompressionMemLevel()
+    {
+        return Impl_->ThreadContexts.empty() ? 8 : Impl_->ThreadContexts.front()->WebSocketContext_->CompressionMemLevel;
+    }
+    void WSListener::set_CompressionWindowBits(int bits)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->DeflateSettings_.CompressionWindowBits = bits;
+        }
+    }
+    int WSListener::get_CompressionWindowBits()
+    {
+        return Impl_->ThreadContexts.empty() ? 15 : Impl_->ThreadContexts.front()->WebSocketContext_->DeflateSettings_.CompressionWindowBits;
+    }
+    void WSListener::set_DecompressionWindowBits(int bits)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->DeflateSettings_.DecompressionWindowBits = bits;
+        }
+    }
+    int WSListener::get_DecompressionWindowBits()
+    {
+        return Impl_->ThreadContexts.empty() ? 15 : Impl_->ThreadContexts.front()->WebSocketContext_->DeflateSettings_.DecompressionWindowBits;
+    }
+    void WSListener::set_CompressionNoContextTakeover(bool notakeover)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->DeflateSettings_.CompressionNoContextTakeover = notakeover;
+        }
+    }
+    bool WSListener::get_CompressionNoContextTakeover()
+    {
+        return Impl_->ThreadContexts.empty() ? false : Impl_->ThreadContexts.front()->WebSocketContext_->DeflateSettings_.CompressionNoContextTakeover;
+    }
+    void WSListener::set_DecompressionNoContextTakeover(bool notakeover)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->DeflateSettings_.DecompressionNoContextTakeover = notakeover;
+        }
+    }
+    bool WSListener::get_DecompressionNoContextTakeover()
+    {
+        return Impl_->ThreadContexts.empty() ? false : Impl_->ThreadContexts.front()->WebSocketContext_->DeflateSettings_.DecompressionNoContextTakeover;
+    }
+    void WSListener::set_InflateMemoryBudget(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->InflateBudget_->Limit = bytes;
+        }
+    }
+    size_t WSListener::get_InflateMemoryBudget()
+    {
+        return Impl_->ThreadContexts.empty() ? 0 : Impl_->ThreadContexts.front()->WebSocketContext_->InflateBudget_->Limit.load();
+    }
+    void WSListener::set_CompressionThreshold(size_t bytes)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->CompressionThreshold = bytes;
+        }
+    }
+    size_t WSListener::get_CompressionThreshold()
+    {
+        return Impl_->ThreadContexts.empty() ? 64 : Impl_->ThreadContexts.front()->WebSocketContext_->CompressionThreshold;
+    }
+    void WSListener::set_CompressionCpuBudget(std::chrono::microseconds budget)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->CompressionCpuBudget = budget;
+        }
+    }
+    std::chrono::microseconds WSListener::get_CompressionCpuBudget()
+    {
+        return Impl_->ThreadContexts.empty() ? std::chrono::microseconds(0) : Impl_->ThreadContexts.front()->WebSocketContext_->CompressionCpuBudget;
+    }
 
     std::shared_ptr<IWSListener_Configuration>
     WSListener_Configuration::onConnection(const std::function<void(const std::shared_ptr<IWebSocket> &, const HttpHeader &)> &handle)
@@ -168,6 +375,15 @@ namespace WS_LITE {
         }
         return std::make_shared<WSListener_Configuration>(Impl_);
     }
+    std::shared_ptr<IWSListener_Configuration> WSListener_Configuration::onMessageChunk(
+        const std::function<void(const std::shared_ptr<IWebSocket> &, const unsigned char *, size_t, OpCode, bool)> &handle)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            assert(!t->WebSocketContext_->onMessageChunk);
+            t->WebSocketContext_->onMessageChunk = handle;
+        }
+        return std::make_shared<WSListener_Configuration>(Impl_);
+    }
     std::shared_ptr<IWSListener_Configuration> WSListener_Configuration::onDisconnection(
         const std::function<void(const std::shared_ptr<IWebSocket> &, unsigned short, const std::string &)> &handle)
     {
@@ -197,6 +413,24 @@ namespace WS_LITE {
         }
         return std::make_shared<WSListener_Configuration>(Impl_);
     }
+    std::shared_ptr<IWSListener_Configuration>
+    WSListener_Configuration::onDrain(const std::function<void(const std::shared_ptr<IWebSocket> &)> &handle)
+    {
+        for (auto &t : Impl_->ThreadContexts) {
+            assert(!t->WebSocketContext_->onDrain);
+            t->WebSocketContext_->onDrain = handle;
+        }
+        return std::make_shared<WSListener_Configuration>(Impl_);
+    }
+    std::shared_ptr<IWSListener_Configuration> WSListener_Configuration::HandlerThreads(ThreadCount threadcount)
+    {
+        assert(!Impl_->Workers);
+        Impl_->Workers = std::make_shared<WorkerPool>(threadcount.value);
+        for (auto &t : Impl_->ThreadContexts) {
+            t->WebSocketContext_->Workers = Impl_->Workers;
+        }
+        return std::make_shared<WSListener_Configuration>(Impl_);
+    }
     std::shared_ptr<IWSHub> WSListener_Configuration::listen(bool no_delay, bool reuse_address)
     {
         if (Impl_->TLSEnabled) {
@@ -0,0 +1,65 @@
+#include "WS_Lite.h"
+#include "internal/HubContext.h"
+#include "internal/PreparedMessage.h"
+#include "internal/WebSocket.h"
+#include "internal/WebSocketProtocol.h"
+#if WIN32
+#include <SDKDDKVer.h>
+#endif
+#include "asio.hpp"
+#include <zlib.h>
+
+namespace SL {
+namespace WS_LITE {
+    namespace {
+        // deflates msg as a whole permessage-deflate message. Returns an empty message if that does not save any space
+        WSMessage Deflate(const WSMessage &msg)
+        {
+            WSMessage compressed = {};
+            z_stream strm = {};
+            if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                return compressed;
+            }
+            // room for the empty block a sync flush ends with
+            auto bound = deflateBound(&strm, static_cast<uLong>(msg.len)) + 16;
+            auto buffer = std::shared_ptr<unsigned char>(new unsigned char[bound], [](unsigned char *p) { delete[] p; });
+            strm.next_in = msg.data;
+            strm.avail_in = static_cast<uInt>(msg.len);
+            strm.next_out = buffer.get();
+            strm.avail_out = static_cast<uInt>(bound);
+            auto err = deflate(&strm, Z_SYNC_FLUSH);
+            size_t produced = bound - strm.avail_out;
+            auto done = err == Z_OK && strm.avail_in == 0 && strm.avail_out > 0;
+            deflateEnd(&strm);
+            // the 00 00 ff ff that ends the flush is left off, receivers append it again
+            if (!done || produced < 4 || produced - 4 >= msg.len) {
+                return compressed;
+            }
+            compressed.Buffer = buffer;
+            compressed.data = buffer.get();
+            compressed.len = produced - 4;
+            compressed.code = msg.code;
+            return compressed;
+        }
+    } // namespace
+
+    std::shared_ptr<PreparedMessage> CreatePreparedMessage(const WSMessage &msg, CompressionOptions compressmessage)
+    {
+        auto prepared = std::make_shared<PreparedMessage>();
+        RandomPool unused; // server headers carry no mask
+        prepared->Message = msg;
+        prepared->HeaderSize = writeheader<true>(prepared->Header, SendQueueItem{msg, compressmessage, SendPriority::NORMAL}, unused);
+        if (compressmessage == CompressionOptions::COMPRESS && (msg.code == OpCode::TEXT || msg.code == OpCode::BINARY)) {
+            prepared->Compressed = Deflate(msg);
+            prepared->CompressedWindowBits = MAX_WBITS;
+            if (prepared->Compressed.Buffer) {
+                SendQueueItem item{prepared->Compressed, compressmessage, SendPriority::NORMAL};
+                item.compressed = true;
+                prepared->CompressedHeaderSize = writeheader<true>(prepared->CompressedHeader, item, unused);
+            }
+        }
+        return prepared;
+    }
+
+} // namespace WS_LITE
+} // namespace SL
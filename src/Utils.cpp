@@ -1,5 +1,15 @@
 #include "WS_Lite.h"
 #include "internal/Utils.h"
+#include <algorithm>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WS_LITE_SSE2 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
 
 namespace SL {
 namespace WS_LITE {
@@ -47,5 +57,166 @@ namespace WS_LITE {
         }
         return true;
     }
+
+    namespace {
+        // length of the sequence a lead byte starts, invalid lead bytes count as one so isValidUtf8 rejects them
+        size_t Utf8SequenceLength(unsigned char c)
+        {
+            if ((c & 0xe0) == 0xc0) {
+                return 2;
+            }
+            if ((c & 0xf0) == 0xe0) {
+                return 3;
+            }
+            if ((c & 0xf8) == 0xf0) {
+                return 4;
+            }
+            return 1;
+        }
+    } // namespace
+    bool Utf8Validator::validate(const unsigned char *s, size_t length, bool last)
+    {
+        if (CarrySize > 0) {
+            auto needed = Utf8SequenceLength(Carry[0]) - CarrySize;
+            auto take = std::min(needed, length);
+            memcpy(Carry + CarrySize, s, take);
+            CarrySize += take;
+            s += take;
+            length -= take;
+            if (take < needed) {
+                return !last;
+            }
+            if (!isValidUtf8(Carry, CarrySize)) {
+                return false;
+            }
+            CarrySize = 0;
+        }
+        // keep back a sequence that runs past the end of this piece
+        size_t tail = 0;
+        for (size_t i = 1; i <= 3 && i <= length; i++) {
+            auto c = s[length - i];
+            if ((c & 0xc0) != 0x80) {
+                tail = Utf8SequenceLength(c) > i ? i : 0;
+                break;
+            }
+        }
+        if (!isValidUtf8(const_cast<unsigned char *>(s), length - tail)) {
+            return false;
+        }
+        memcpy(Carry, s + length - tail, tail);
+        CarrySize = tail;
+        return !last || CarrySize == 0;
+    }
+
+    namespace {
+        typedef void (*MaskFunction)(unsigned char *, const unsigned char *, size_t, uint32_t);
+
+        // mask is stored in memory order, so byte i of the payload is xored with byte (i % 4) of the mask word
+        void ApplyMaskScalar(unsigned char *dst, const unsigned char *src, size_t length, uint32_t mask)
+        {
+            uint64_t mask8 = (static_cast<uint64_t>(mask) << 32) | mask;
+            size_t i = 0;
+            for (; i + 8 <= length; i += 8) {
+                uint64_t v;
+                memcpy(&v, src + i, 8);
+                v ^= mask8;
+                memcpy(dst + i, &v, 8);
+            }
+            auto m = reinterpret_cast<const unsigned char *>(&mask);
+            for (; i < length; i++) {
+                dst[i] = src[i] ^ m[i % 4];
+            }
+        }
+#if WS_LITE_SSE2
+        void ApplyMaskSSE2(unsigned char *dst, const unsigned char *src, size_t length, uint32_t mask)
+        {
+            auto mask16 = _mm_set1_epi32(static_cast<int>(mask));
+            size_t i = 0;
+            for (; i + 64 <= length; i += 64) {
+                auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+                auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 16));
+                auto c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 32));
+                auto d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 48));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(a, mask16));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 16), _mm_xor_si128(b, mask16));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 32), _mm_xor_si128(c, mask16));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 48), _mm_xor_si128(d, mask16));
+            }
+            for (; i + 16 <= length; i += 16) {
+                auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(a, mask16));
+            }
+            // i is a multiple of 4 here so the mask word is still in phase
+            ApplyMaskScalar(dst + i, src + i, length - i, mask);
+        }
+#if defined(__GNUC__) || defined(__clang__)
+        __attribute__((target("avx2")))
+#endif
+        void ApplyMaskAVX2(unsigned char *dst, const unsigned char *src, size_t length, uint32_t mask)
+        {
+            auto mask32 = _mm256_set1_epi32(static_cast<int>(mask));
+            size_t i = 0;
+            for (; i + 128 <= length; i += 128) {
+                auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+                auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 32));
+                auto c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 64));
+                auto d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 96));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_xor_si256(a, mask32));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i + 32), _mm256_xor_si256(b, mask32));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i + 64), _mm256_xor_si256(c, mask32));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i + 96), _mm256_xor_si256(d, mask32));
+            }
+            for (; i + 32 <= length; i += 32) {
+                auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_xor_si256(a, mask32));
+            }
+            ApplyMaskSSE2(dst + i, src + i, length - i, mask);
+        }
+        bool CpuSupportsAVX2()
+        {
+#if defined(_MSC_VER)
+            int info[4] = {};
+            __cpuid(info, 0);
+            if (info[0] < 7) {
+                return false;
+            }
+            __cpuid(info, 1);
+            auto osxsave = (info[2] & (1 << 27)) != 0;
+            auto avx = (info[2] & (1 << 28)) != 0;
+            if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+                return false;
+            }
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            return __builtin_cpu_supports("avx2");
+#endif
+        }
+#endif
+        MaskFunction SelectMaskFunction()
+        {
+#if WS_LITE_SSE2
+            if (CpuSupportsAVX2()) {
+                return ApplyMaskAVX2;
+            }
+            return ApplyMaskSSE2;
+#else
+            return ApplyMaskScalar;
+#endif
+        }
+    } // namespace
+
+    void ApplyMask(unsigned char *dst, const unsigned char *src, size_t length, const unsigned char *mask, size_t maskoffset)
+    {
+        static const auto maskfunction = SelectMaskFunction();
+        // rotate the mask so byte 0 of the word lines up with src[0]
+        unsigned char rotated[4];
+        for (auto i = 0; i < 4; i++) {
+            rotated[i] = mask[(maskoffset + i) % 4];
+        }
+        uint32_t mask32;
+        memcpy(&mask32, rotated, 4);
+        maskfunction(dst, src, length, mask32);
+    }
 } // namespace WS_LITE
 } // namespace SL
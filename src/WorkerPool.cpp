@@ -0,0 +1,106 @@
+#include "internal/WorkerPool.h"
+
+namespace SL {
+namespace WS_LITE {
+    namespace {
+        // lets post find the queue of the worker calling it
+        thread_local WorkerPool *CurrentPool = nullptr;
+        thread_local size_t CurrentWorker = 0;
+    } // namespace
+
+    WorkerPool::WorkerPool(size_t threads)
+    {
+        for (size_t i = 0; i < threads; i++) {
+            Workers.push_back(std::make_unique<Worker>());
+        }
+        for (size_t i = 0; i < threads; i++) {
+            Workers[i]->Thread = std::thread([this, i] { run(i); });
+        }
+    }
+    WorkerPool::~WorkerPool() { stop(); }
+
+    void WorkerPool::post(std::function<void()> task)
+    {
+        if (Workers.empty()) {
+            return;
+        }
+        auto target = CurrentPool == this ? CurrentWorker : NextWorker.fetch_add(1, std::memory_order_relaxed) % Workers.size();
+        {
+            std::lock_guard<std::mutex> lock(Workers[target]->Lock);
+            if (Stopping && !CurrentPool) {
+                return;
+            }
+            Workers[target]->Tasks.push_back(std::move(task));
+        }
+        Queued.fetch_add(1);
+        if (Sleeping.load() > 0) {
+            std::lock_guard<std::mutex> lock(IdleLock);
+            Idle.notify_one();
+        }
+    }
+    bool WorkerPool::take(size_t self, std::function<void()> &task)
+    {
+        // oldest first from its own queue, newest first from the others
+        for (size_t i = 0; i < Workers.size(); i++) {
+            auto &worker = *Workers[(self + i) % Workers.size()];
+            std::lock_guard<std::mutex> lock(worker.Lock);
+            if (!worker.Tasks.empty()) {
+                if (i == 0) {
+                    task = std::move(worker.Tasks.front());
+                    worker.Tasks.pop_front();
+                }
+                else {
+                    task = std::move(worker.Tasks.back());
+                    worker.Tasks.pop_back();
+                }
+                Queued.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+    void WorkerPool::run(size_t self)
+    {
+        CurrentPool = this;
+        CurrentWorker = self;
+        std::function<void()> task;
+        for (;;) {
+            if (take(self, task)) {
+                task();
+                task = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(IdleLock);
+            Sleeping.fetch_add(1);
+            while (!Stopping && Queued.load() == 0) {
+                Idle.wait(lock);
+            }
+            Sleeping.fetch_sub(1);
+            if (Stopping && Queued.load() == 0) {
+                return;
+            }
+        }
+    }
+    void WorkerPool::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(IdleLock);
+            if (Stopping) {
+                return;
+            }
+            Stopping = true;
+        }
+        Idle.notify_all();
+        for (auto &worker : Workers) {
+            if (worker->Thread.joinable()) {
+                if (std::this_thread::get_id() == worker->Thread.get_id()) {
+                    worker->Thread.detach(); // a handler is shutting the hub down
+                }
+                else {
+                    worker->Thread.join();
+                }
+            }
+        }
+    }
+} // namespace WS_LITE
+} // namespace SL